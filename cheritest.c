@@ -38,12 +38,19 @@
 #endif
 
 #include <sys/param.h>
+#include <sys/event.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/sysctl.h>
 #include <sys/time.h>
 #include <sys/ucontext.h>
+#include <sys/user.h>
 #include <sys/wait.h>
 
+#include <machine/atomic.h>
+
 #ifndef LIST_ONLY
 #include <cheri/cheri.h>
 #include <cheri/cheric.h>
@@ -58,15 +65,22 @@
 #include <cheri/sandbox.h>
 
 #include <machine/sysarch.h>
+
+#include <pmc.h>
 #endif
 
 #include <assert.h>
 #include <cheritest-helper.h>
+#include <elf.h>
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <fnmatch.h>
+#include <getopt.h>
 #include <inttypes.h>
+#include <libutil.h>
+#include <limits.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -74,6 +88,7 @@
 #include <string.h>
 #include <stringlist.h>
 #include <sysexits.h>
+#include <time.h>
 #include <unistd.h>
 #include <vis.h>
 
@@ -85,6 +100,19 @@
 #include "cheritest_list_only.h"
 #endif
 
+/*
+ * Tags for tests in cheritest_registry.h, generated from cheri_tests[] by
+ * gen_cheritest_registry.awk along with a perfect hash over test names.
+ */
+#define	CHERITEST_TAG_SANDBOX	0x01	/* CT_FLAG_SANDBOX */
+#define	CHERITEST_TAG_SLOW	0x02	/* CT_FLAG_SLOW */
+#define	CHERITEST_TAG_SIGNAL	0x04	/* CT_FLAG_SIGNAL{,_UNWIND} */
+#define	CHERITEST_TAG_PURECAP	0x08	/* Pure-capability builds only. */
+#define	CHERITEST_TAG_BENCH	0x10	/* CT_FLAG_BENCH */
+#define	CHERITEST_NTAGS		5
+
+#include "cheritest_registry.h"
+
 #ifndef SIGPROT
 #define	SIGPROT				0
 #define	PROT_CHERI_BOUNDS		0
@@ -750,15 +778,18 @@ static const struct cheri_test cheri_tests[] = {
 
 	{ .ct_name = "test_nofault_ccall_creturn",
 	  .ct_desc = "Exercise CCall/CReturn",
-	  .ct_func = test_nofault_ccall_creturn },
+	  .ct_func = test_nofault_ccall_creturn,
+	  .ct_fixtures = CT_FIXTURE_CCALL },
 
 	{ .ct_name = "test_nofault_ccall_nop_creturn",
 	  .ct_desc = "Exercise CCall/NOP/NOP/NOP/CReturn",
-	  .ct_func = test_nofault_ccall_nop_creturn },
+	  .ct_func = test_nofault_ccall_nop_creturn,
+	  .ct_fixtures = CT_FIXTURE_CCALL },
 
 	{ .ct_name = "test_nofault_ccall_dli_creturn",
 	  .ct_desc = "Exercise CCall/DLI/CReturn",
-	  .ct_func = test_nofault_ccall_dli_creturn },
+	  .ct_func = test_nofault_ccall_dli_creturn,
+	  .ct_fixtures = CT_FIXTURE_CCALL },
 
 	/*
 	 * Further CCall/CReturn test cases the exercise various call-time
@@ -767,6 +798,7 @@ static const struct cheri_test cheri_tests[] = {
 	{ .ct_name = "test_fault_ccall_code_untagged",
 	  .ct_desc = "Invoke CCall with untagged code capability",
 	  .ct_func = test_fault_ccall_code_untagged,
+	  .ct_fixtures = CT_FIXTURE_CCALL,
 	  .ct_flags = CT_FLAG_SIGNAL | CT_FLAG_SI_CODE |
 		    CT_FLAG_MIPS_EXCCODE | CT_FLAG_CP2_EXCCODE,
 	  .ct_signum = SIGPROT,
@@ -777,6 +809,7 @@ static const struct cheri_test cheri_tests[] = {
 	{ .ct_name = "test_fault_ccall_data_untagged",
 	  .ct_desc = "Invoke CCall with an untagged data capability",
 	  .ct_func = test_fault_ccall_data_untagged,
+	  .ct_fixtures = CT_FIXTURE_CCALL,
 	  .ct_flags = CT_FLAG_SIGNAL | CT_FLAG_SI_CODE |
 		    CT_FLAG_MIPS_EXCCODE | CT_FLAG_CP2_EXCCODE,
 	  .ct_signum = SIGPROT,
@@ -787,6 +820,7 @@ static const struct cheri_test cheri_tests[] = {
 	{ .ct_name = "test_fault_ccall_code_unsealed",
 	  .ct_desc = "Invoke CCall with an unsealed code capability",
 	  .ct_func = test_fault_ccall_code_unsealed,
+	  .ct_fixtures = CT_FIXTURE_CCALL,
 	  .ct_flags = CT_FLAG_SIGNAL | CT_FLAG_SI_CODE |
 		    CT_FLAG_MIPS_EXCCODE | CT_FLAG_CP2_EXCCODE,
 	  .ct_signum = SIGPROT,
@@ -797,6 +831,7 @@ static const struct cheri_test cheri_tests[] = {
 	{ .ct_name = "test_fault_ccall_data_unsealed",
 	  .ct_desc = "Invoke CCall with an unsealed data capability",
 	  .ct_func = test_fault_ccall_data_unsealed,
+	  .ct_fixtures = CT_FIXTURE_CCALL,
 	  .ct_flags = CT_FLAG_SIGNAL | CT_FLAG_SI_CODE |
 		    CT_FLAG_MIPS_EXCCODE | CT_FLAG_CP2_EXCCODE,
 	  .ct_signum = SIGPROT,
@@ -807,6 +842,7 @@ static const struct cheri_test cheri_tests[] = {
 	{ .ct_name = "test_fault_ccall_typemismatch",
 	  .ct_desc = "Invoke CCall with code/data type mismatch",
 	  .ct_func = test_fault_ccall_typemismatch,
+	  .ct_fixtures = CT_FIXTURE_CCALL,
 	  .ct_flags = CT_FLAG_SIGNAL | CT_FLAG_SI_CODE |
 		    CT_FLAG_MIPS_EXCCODE | CT_FLAG_CP2_EXCCODE,
 	  .ct_signum = SIGPROT,
@@ -817,6 +853,7 @@ static const struct cheri_test cheri_tests[] = {
 	{ .ct_name = "test_fault_ccall_code_noexecute",
 	  .ct_desc = "Invoke CCall with a non-executable code capability",
 	  .ct_func = test_fault_ccall_code_noexecute,
+	  .ct_fixtures = CT_FIXTURE_CCALL,
 	  .ct_flags = CT_FLAG_SIGNAL | CT_FLAG_SI_CODE |
 		    CT_FLAG_MIPS_EXCCODE | CT_FLAG_CP2_EXCCODE,
 	  .ct_signum = SIGPROT,
@@ -827,6 +864,7 @@ static const struct cheri_test cheri_tests[] = {
 	{ .ct_name = "test_fault_ccall_data_execute",
 	  .ct_desc = "Invoke CCall with an executable data capability",
 	  .ct_func = test_fault_ccall_data_execute,
+	  .ct_fixtures = CT_FIXTURE_CCALL,
 	  .ct_flags = CT_FLAG_SIGNAL | CT_FLAG_SI_CODE |
 		    CT_FLAG_MIPS_EXCCODE | CT_FLAG_CP2_EXCCODE,
 	  .ct_signum = SIGPROT,
@@ -835,6 +873,29 @@ static const struct cheri_test cheri_tests[] = {
 	  .ct_cp2_exccode = CHERI_EXCCODE_PERM_EXECUTE },
 #endif
 
+	/*
+	 * Round-trip cost of the CCall/CReturn sandboxes above.  These need
+	 * only the sandboxes and the sealed capabilities that the CCALL
+	 * fixture makes for them, not the tests' expected faults.
+	 */
+	{ .ct_name = "bench_ccall_creturn",
+	  .ct_desc = "Time CCall/CReturn",
+	  .ct_bench = bench_ccall_creturn,
+	  .ct_fixtures = CT_FIXTURE_CCALL,
+	  .ct_flags = CT_FLAG_BENCH },
+
+	{ .ct_name = "bench_ccall_nop_creturn",
+	  .ct_desc = "Time CCall/NOP/NOP/NOP/CReturn",
+	  .ct_bench = bench_ccall_nop_creturn,
+	  .ct_fixtures = CT_FIXTURE_CCALL,
+	  .ct_flags = CT_FLAG_BENCH },
+
+	{ .ct_name = "bench_ccall_dli_creturn",
+	  .ct_desc = "Time CCall/DLI/CReturn",
+	  .ct_bench = bench_ccall_dli_creturn,
+	  .ct_fixtures = CT_FIXTURE_CCALL,
+	  .ct_flags = CT_FLAG_BENCH },
+
 	/*
 	 * Test libcheri sandboxing -- and kernel sandbox unwind.
 	 */
@@ -846,7 +907,8 @@ static const struct cheri_test cheri_tests[] = {
 	{ .ct_name = "test_sandbox_clock_gettime",
 	  .ct_desc = "Exercise clock_gettime() in a libcheri sandbox",
 	  .ct_func = test_sandbox_cs_clock_gettime,
-	  .ct_flags = CT_FLAG_STDOUT_IGNORE | CT_FLAG_SANDBOX, },
+	  .ct_flags = CT_FLAG_STDOUT_IGNORE | CT_FLAG_SANDBOX |
+		    CT_FLAG_NO_BATCH, },
 
 	{ .ct_name = "test_sandbox_clock_gettime_default",
 	  .ct_desc = "Unauthorized call of clock_gettime() in a sandbox",
@@ -856,7 +918,8 @@ static const struct cheri_test cheri_tests[] = {
 	{ .ct_name = "test_sandbox_clock_gettime_deny",
 	  .ct_desc = "Denied call of clock_gettime() in a sandbox",
 	  .ct_func = test_sandbox_cs_clock_gettime_deny,
-	  .ct_flags = CT_FLAG_STDOUT_IGNORE | CT_FLAG_SANDBOX, },
+	  .ct_flags = CT_FLAG_STDOUT_IGNORE | CT_FLAG_SANDBOX |
+		    CT_FLAG_NO_BATCH, },
 
 	{ .ct_name = "test_sandbox_cp2_bound_catch",
 	  .ct_desc = "Exercise sandboxed CP2 bounds-check failure; caught",
@@ -997,6 +1060,103 @@ static const struct cheri_test cheri_tests[] = {
 	  .ct_func = test_sandbox_vm_xfault_nocatch,
 	  .ct_flags = CT_FLAG_SANDBOX, },
 
+	{ .ct_name = "bench_sandbox_cp2_bound_fault",
+	  .ct_desc = "Time sandboxed CP2 bounds faults, caught",
+	  .ct_bench = bench_sandbox_cp2_fault,
+	  .ct_arg = CHERITEST_HELPER_CAP_FAULT_CP2_BOUND,
+	  .ct_flags = CT_FLAG_SI_CODE | CT_FLAG_MIPS_EXCCODE |
+		    CT_FLAG_CP2_EXCCODE | CT_FLAG_SIGNAL_UNWIND |
+		    CT_FLAG_SANDBOX | CT_FLAG_BENCH,
+	  .ct_signum = SIGPROT,
+	  .ct_si_code = PROT_CHERI_BOUNDS,
+	  .ct_mips_exccode = T_C2E,
+	  .ct_cp2_exccode = CHERI_EXCCODE_LENGTH },
+
+	{ .ct_name = "bench_sandbox_cp2_perm_load_fault",
+	  .ct_desc = "Time sandboxed CP2 load-perm faults, caught",
+	  .ct_bench = bench_sandbox_cp2_fault,
+	  .ct_arg = CHERITEST_HELPER_CAP_FAULT_CP2_PERM_LOAD,
+	  .ct_flags = CT_FLAG_SI_CODE | CT_FLAG_MIPS_EXCCODE |
+		    CT_FLAG_CP2_EXCCODE | CT_FLAG_SIGNAL_UNWIND |
+		    CT_FLAG_SANDBOX | CT_FLAG_BENCH,
+	  .ct_signum = SIGPROT,
+	  .ct_si_code = PROT_CHERI_PERM,
+	  .ct_mips_exccode = T_C2E,
+	  .ct_cp2_exccode = CHERI_EXCCODE_PERM_LOAD },
+
+	{ .ct_name = "bench_sandbox_cp2_perm_store_fault",
+	  .ct_desc = "Time sandboxed CP2 store-perm faults, caught",
+	  .ct_bench = bench_sandbox_cp2_fault,
+	  .ct_arg = CHERITEST_HELPER_CAP_FAULT_CP2_PERM_STORE,
+	  .ct_flags = CT_FLAG_SI_CODE | CT_FLAG_MIPS_EXCCODE |
+		    CT_FLAG_CP2_EXCCODE | CT_FLAG_SIGNAL_UNWIND |
+		    CT_FLAG_SANDBOX | CT_FLAG_BENCH,
+	  .ct_signum = SIGPROT,
+	  .ct_si_code = PROT_CHERI_PERM,
+	  .ct_mips_exccode = T_C2E,
+	  .ct_cp2_exccode = CHERI_EXCCODE_PERM_STORE },
+
+	{ .ct_name = "bench_sandbox_cp2_tag_fault",
+	  .ct_desc = "Time sandboxed CP2 tag faults, caught",
+	  .ct_bench = bench_sandbox_cp2_fault,
+	  .ct_arg = CHERITEST_HELPER_CAP_FAULT_CP2_TAG,
+	  .ct_flags = CT_FLAG_SI_CODE | CT_FLAG_MIPS_EXCCODE |
+		    CT_FLAG_CP2_EXCCODE | CT_FLAG_SIGNAL_UNWIND |
+		    CT_FLAG_SANDBOX | CT_FLAG_BENCH,
+	  .ct_signum = SIGPROT,
+	  .ct_si_code = PROT_CHERI_TAG,
+	  .ct_mips_exccode = T_C2E,
+	  .ct_cp2_exccode = CHERI_EXCCODE_TAG },
+
+	{ .ct_name = "bench_sandbox_cp2_seal_fault",
+	  .ct_desc = "Time sandboxed CP2 seal faults, caught",
+	  .ct_bench = bench_sandbox_cp2_fault,
+	  .ct_arg = CHERITEST_HELPER_CAP_FAULT_CP2_SEAL,
+	  .ct_flags = CT_FLAG_SI_CODE | CT_FLAG_MIPS_EXCCODE |
+		    CT_FLAG_CP2_EXCCODE | CT_FLAG_SIGNAL_UNWIND |
+		    CT_FLAG_SANDBOX | CT_FLAG_BENCH,
+	  .ct_signum = SIGPROT,
+	  .ct_si_code = PROT_CHERI_PERM,
+	  .ct_mips_exccode = T_C2E,
+	  .ct_cp2_exccode = CHERI_EXCCODE_PERM_SEAL },
+
+	{ .ct_name = "bench_sandbox_divzero_fault",
+	  .ct_desc = "Time sandboxed divide-by-zero traps, caught",
+	  .ct_bench = bench_sandbox_divzero,
+	  .ct_flags = CT_FLAG_MIPS_EXCCODE | CT_FLAG_SIGNAL_UNWIND |
+		    CT_FLAG_SANDBOX | CT_FLAG_BENCH,
+	  .ct_signum = SIGTRAP,
+	  .ct_mips_exccode = T_TRAP,
+	  .ct_xfail_reason =
+	    "LLVM assembler generates break rather than trap instruction", },
+
+	{ .ct_name = "bench_sandbox_vm_rfault",
+	  .ct_desc = "Time sandboxed VM read faults, caught",
+	  .ct_bench = bench_sandbox_vm_fault,
+	  .ct_arg = CHERITEST_HELPER_VM_FAULT_RFAULT,
+	  .ct_flags = CT_FLAG_MIPS_EXCCODE | CT_FLAG_SIGNAL_UNWIND |
+		    CT_FLAG_SANDBOX | CT_FLAG_BENCH,
+	  .ct_signum = SIGSEGV,
+	  .ct_mips_exccode = T_TLB_LD_MISS },
+
+	{ .ct_name = "bench_sandbox_vm_wfault",
+	  .ct_desc = "Time sandboxed VM write faults, caught",
+	  .ct_bench = bench_sandbox_vm_fault,
+	  .ct_arg = CHERITEST_HELPER_VM_FAULT_WFAULT,
+	  .ct_flags = CT_FLAG_MIPS_EXCCODE | CT_FLAG_SIGNAL_UNWIND |
+		    CT_FLAG_SANDBOX | CT_FLAG_BENCH,
+	  .ct_signum = SIGSEGV,
+	  .ct_mips_exccode = T_TLB_ST_MISS },
+
+	{ .ct_name = "bench_sandbox_vm_xfault",
+	  .ct_desc = "Time sandboxed VM exec faults, caught",
+	  .ct_bench = bench_sandbox_vm_fault,
+	  .ct_arg = CHERITEST_HELPER_VM_FAULT_XFAULT,
+	  .ct_flags = CT_FLAG_MIPS_EXCCODE | CT_FLAG_SIGNAL_UNWIND |
+		    CT_FLAG_SANDBOX | CT_FLAG_BENCH,
+	  .ct_signum = SIGSEGV,
+	  .ct_mips_exccode = T_TLB_LD_MISS },
+
 	{ .ct_name = "test_sandbox_helloworld",
 	  .ct_desc = "Print 'hello world' in a libcheri sandbox",
 	  .ct_func = test_sandbox_cs_helloworld,
@@ -1018,12 +1178,13 @@ static const struct cheri_test cheri_tests[] = {
 	{ .ct_name = "test_2sandbox_newdestroy",
 	  .ct_desc = "Instantiate and destroy a second sandbox object",
 	  .ct_func = test_2sandbox_newdestroy,
-	  .ct_flags = CT_FLAG_SLOW |  CT_FLAG_SANDBOX, },
+	  .ct_flags = CT_FLAG_SLOW |  CT_FLAG_SANDBOX,
+	  .ct_fixtures = CT_FIXTURE_SANDBOX_CLASS, },
 
 	{ .ct_name = "test_2sandbox_var_data_getset",
 	  .ct_desc = "Instantiate second object and get/set variables",
 	  .ct_func = test_2sandbox_var_data_getset,
-          .ct_flags = CT_FLAG_SLOW | CT_FLAG_SANDBOX, },
+          .ct_flags = CT_FLAG_SLOW | CT_FLAG_SANDBOX | CT_FLAG_NO_BATCH, },
 
 	{ .ct_name = "test_sandbox_malloc",
 	  .ct_desc = "Malloc memory in a libcheri sandbox",
@@ -1095,29 +1256,34 @@ static const struct cheri_test cheri_tests[] = {
 	{ .ct_name = "test_sandbox_fd_fstat",
 	  .ct_desc = "Exercise fstat() on a cheri_fd in a libcheri sandbox",
 	  .ct_func = test_sandbox_fd_fstat,
-	  .ct_flags = CT_FLAG_SANDBOX, },
+	  .ct_flags = CT_FLAG_SANDBOX,
+	  .ct_fixtures = CT_FIXTURE_SANDBOX_OBJECT | CT_FIXTURE_FD, },
 
 	{ .ct_name = "test_sandbox_fd_lseek",
 	  .ct_desc = "Exercise lseek() on a cheri_fd in a libcheri sandbox",
 	  .ct_func = test_sandbox_fd_lseek,
-	  .ct_flags = CT_FLAG_SANDBOX, },
+	  .ct_flags = CT_FLAG_SANDBOX,
+	  .ct_fixtures = CT_FIXTURE_SANDBOX_OBJECT | CT_FIXTURE_FD, },
 
 	{ .ct_name = "test_sandbox_fd_read",
 	  .ct_desc = "Exercise read() on a cheri_fd in a libcheri sandbox",
 	  .ct_func = test_sandbox_fd_read,
 	  .ct_flags = CT_FLAG_STDIN_STRING | CT_FLAG_SANDBOX,
+	  .ct_fixtures = CT_FIXTURE_SANDBOX_OBJECT | CT_FIXTURE_FD,
 	  .ct_stdin_string = CHERITEST_FD_READ_STR },
 
 	{ .ct_name = "test_sandbox_fd_read_revoke",
 	  .ct_desc = "Exercise revoke() before read() on a cheri_fd",
 	  .ct_func = test_sandbox_fd_read_revoke,
 	  .ct_flags = CT_FLAG_STDIN_STRING | CT_FLAG_SANDBOX,
+	  .ct_fixtures = CT_FIXTURE_SANDBOX_OBJECT | CT_FIXTURE_FD,
 	  .ct_stdin_string = CHERITEST_FD_READ_STR },
 
 	{ .ct_name = "test_sandbox_fd_write",
 	  .ct_desc = "Exercise write() on a cheri_fd in a libcheri sandbox",
 	  .ct_func = test_sandbox_fd_write,
 	  .ct_flags = CT_FLAG_STDOUT_STRING | CT_FLAG_SANDBOX,
+	  .ct_fixtures = CT_FIXTURE_SANDBOX_OBJECT | CT_FIXTURE_FD,
 	  .ct_stdout_string = CHERITEST_FD_WRITE_STR },
 
 	{ .ct_name = "test_sandbox_fd_write_revoke",
@@ -1125,13 +1291,29 @@ static const struct cheri_test cheri_tests[] = {
 	  .ct_func = test_sandbox_fd_write_revoke,
 	  /* NB: String defined but flag not set: shouldn't print. */
 	  .ct_stdout_string = "write123",
-	  .ct_flags = CT_FLAG_SANDBOX, },
+	  .ct_flags = CT_FLAG_SANDBOX | CT_FLAG_NO_BATCH,
+	  .ct_fixtures = CT_FIXTURE_SANDBOX_OBJECT | CT_FIXTURE_FD, },
 
 	{ .ct_name = "test_sandbox_userfn",
 	  .ct_desc = "Exercise user-defined system-class method",
 	  .ct_func = test_sandbox_userfn,
 	  .ct_flags = CT_FLAG_SANDBOX, },
 
+	{ .ct_name = "bench_sandbox_invoke",
+	  .ct_desc = "Time invocation of a trivial sandbox method",
+	  .ct_bench = bench_sandbox_invoke,
+	  .ct_flags = CT_FLAG_SANDBOX | CT_FLAG_BENCH, },
+
+	{ .ct_name = "bench_sandbox_userfn",
+	  .ct_desc = "Time sandbox invocation with a callback to the host",
+	  .ct_bench = bench_sandbox_userfn,
+	  .ct_flags = CT_FLAG_SANDBOX | CT_FLAG_BENCH, },
+
+	{ .ct_name = "bench_sandbox_userfn_marshal",
+	  .ct_desc = "Time user-defined method calls by argument count",
+	  .ct_func = bench_sandbox_userfn_marshal,
+	  .ct_flags = CT_FLAG_SANDBOX | CT_FLAG_BENCH, },
+
 	{ .ct_name = "test_sandbox_getstack",
 	  .ct_desc = "Exercise CHERI_GET_STACK sysarch()",
 	  .ct_func = test_sandbox_getstack,
@@ -1145,7 +1327,13 @@ static const struct cheri_test cheri_tests[] = {
 	{ .ct_name = "test_sandbox_setstack",
 	  .ct_desc = "Exercise CHERI_SET_STACK sysarch() to change stack",
 	  .ct_func = test_sandbox_setstack,
-	  .ct_flags = CT_FLAG_SANDBOX, },
+	  .ct_flags = CT_FLAG_SANDBOX | CT_FLAG_NO_BATCH, },
+
+	{ .ct_name = "bench_sandbox_nest",
+	  .ct_desc = "Time nested callbacks and trusted-stack operations",
+	  .ct_func_arg = bench_sandbox_nest,
+	  .ct_arg = 32,
+	  .ct_flags = CT_FLAG_SANDBOX | CT_FLAG_BENCH | CT_FLAG_NO_BATCH, },
 
 	/*
 	 * Check various properties to do with global vs. local capabilities
@@ -1231,7 +1419,7 @@ static const struct cheri_test cheri_tests[] = {
 	{ .ct_name = "test_sandbox_var_data_getset",
 	  .ct_desc = "Get and set .data variables over multiple invocations",
 	  .ct_func = test_sandbox_var_data_getset,
-	  .ct_flags = CT_FLAG_SANDBOX, },
+	  .ct_flags = CT_FLAG_SANDBOX | CT_FLAG_NO_BATCH, },
 
 	{ .ct_name = "test_sandbox_var_constructor",
 	  .ct_desc = "Check initial value of constructor-initalised variable",
@@ -1253,6 +1441,10 @@ static const struct cheri_test cheri_tests[] = {
 	{ .ct_name = "test_string_memmove_c",
 	  .ct_desc = "Test explicit capability memmove",
 	  .ct_func = test_string_memmove_c },
+	{ .ct_name = "bench_string_memcpy_c",
+	  .ct_desc = "Time explicit capability memcpy of a page",
+	  .ct_bench = bench_string_memcpy_c,
+	  .ct_flags = CT_FLAG_BENCH },
 
 	/*
 	 * zlib tests.
@@ -1298,21 +1490,80 @@ static const struct cheri_test cheri_tests[] = {
 };
 static const u_int cheri_tests_len = sizeof(cheri_tests) /
 	    sizeof(cheri_tests[0]);
+_Static_assert(sizeof(cheri_tests) / sizeof(cheri_tests[0]) ==
+    CHERITEST_NTESTS, "cheritest_registry.h does not match cheri_tests[]");
 static StringList* cheri_failed_tests;
 static StringList* cheri_xfailed_tests;
 
-/* Shared memory page with child process. */
+/*
+ * Shared memory with child processes: one slot per concurrently running
+ * child, and a pointer to the slot used by the current process.
+ */
+#define	CHERITEST_MAX_JOBS	64
+static struct cheritest_slot *ccsp_slots;
 struct cheritest_child_state *ccsp;
 
-static int tests_failed, tests_passed, tests_xfailed;
+static const struct cheri_test **cheri_selected_tests;
+static u_int cheri_selected_tests_len;
+
+static int tests_failed, tests_passed, tests_xfailed, tests_timedout;
 static int expected_failures;
+static int batch;
 static int list;
 static int run_all;
 static int fast_tests_only;
+static u_int capacity_benchmark;
+static u_int class_benchmark;
+static u_int fork_benchmark;
+static u_int pool_benchmark;
+static u_int snapshot_benchmark;
+static u_int njobs = 1;
+#define	CHERITEST_REPEAT_MAX	100000
+static u_int repeat_count = 1;
 static int qtrace;
 static int sleep_after_test;
+static int timeout_override = -1;
 static int unsandboxed_tests_only;
 static int verbose;
+static const char *convert_path;
+static const char *convert_format = "xo";
+
+/*
+ * Tests are divided between shards of a run, each of which may be run on a
+ * different machine, so that those in shard 'shard_index' (from 1) of
+ * 'shard_count' are selected.
+ */
+static u_int shard_index, shard_count;
+
+#define	CHERITEST_OPT_SHARD		256
+#define	CHERITEST_OPT_JOURNAL		257
+#define	CHERITEST_OPT_RESUME		258
+#define	CHERITEST_OPT_RERUN_FAILED	259
+#define	CHERITEST_OPT_CONVERT		260
+#define	CHERITEST_OPT_FORMAT		261
+#define	CHERITEST_OPT_PMC		262
+
+#define	CHERITEST_PMC_DEFAULT						\
+	"cycles,instructions,dc-misses,branch-mispredicts"
+
+static const struct option longopts[] = {
+	{ "shard",	  required_argument,	NULL,	CHERITEST_OPT_SHARD },
+	{ "convert",	  required_argument,	NULL,	CHERITEST_OPT_CONVERT },
+	{ "format",	  required_argument,	NULL,	CHERITEST_OPT_FORMAT },
+#ifndef LIST_ONLY
+	{ "journal",	  required_argument,	NULL,	CHERITEST_OPT_JOURNAL },
+	{ "resume",	  no_argument,		NULL,	CHERITEST_OPT_RESUME },
+	{ "rerun-failed", no_argument,		NULL,
+	    CHERITEST_OPT_RERUN_FAILED },
+	{ "pmc",	  optional_argument,	NULL,	CHERITEST_OPT_PMC },
+#endif
+	{ NULL,		  0,			NULL,	0 }
+};
+
+static u_int	cheritest_list_select(const struct cheri_test **tests);
+#ifndef LIST_ONLY
+static void	cheritest_pmc_stop(void);
+#endif
 
 static void
 usage(void)
@@ -1321,20 +1572,50 @@ usage(void)
 	fprintf(stderr,
 "usage:\n"
 "    cheritest [options] -l               -- List tests\n"
+"    cheritest [options] --convert <file> -- Print the results recorded\n"
+"                                            in binary journal <file>\n"
 #ifndef LIST_ONLY
-"    cheritest [options] -a               -- Run all tests\n"
+"    cheritest [options] -a               -- Run all tests but benchmarks\n"
 "    cheritest [options] <test> [...]     -- Run specified tests\n"
 "    cheritest [options] -g <glob> [...]  -- Run matching tests\n"
+"    cheritest [options] -C <n>           -- Time <n> loads of the helper\n"
+"                                            class, by phase\n"
+"    cheritest [options] -F <n>           -- Time <n> fork()s, with and\n"
+"                                            without libcheri loaded\n"
+"    cheritest [options] -O <n>           -- Time up to <n> live and\n"
+"                                            churned sandbox objects, for\n"
+"                                            several heap sizes\n"
+"    cheritest [options] -P <n>           -- Time <n> sandbox objects taken\n"
+"                                            from the pool and constructed\n"
+"    cheritest [options] -S <n>           -- Time <n> object snapshot\n"
+"                                            restores, for several heap sizes\n"
 #endif
 "\n"
 "options:\n"
+#ifndef LIST_ONLY
+"    -b  -- Run tests that permit it in persistent worker processes\n"
+"    -B <file>  -- Record results in binary journal <file>, not stdout\n"
+#endif
 "    -f  -- Only include \"fast\" tests\n"
+"    -H <file>  -- Keep test duration history in <file> (\"\": none)\n"
 #ifndef LIST_ONLY
+"    -j <n>  -- Run up to <n> tests concurrently\n"
 "    -s  -- Sleep one second after each test\n"
 "    -q  -- Enable qemu tracing in test process\n"
+"    -r <n>  -- Run each test <n> times, and report timing statistics\n"
+"    -t <secs>  -- Kill tests running longer than <secs> (0: never)\n"
 #endif
 "    -u  -- Only include unsandboxed tests\n"
 "    -v  -- Increase verbosity\n"
+"    --shard <i>/<n>  -- Only include the <i>th of <n> shards of the tests\n"
+"    --format xo|junit|tap  -- Output format for --convert (default: xo)\n"
+#ifndef LIST_ONLY
+"    --journal <file>  -- Record test outcomes in <file>\n"
+"    --resume  -- Run the tests not yet passed in the journalled run\n"
+"    --rerun-failed  -- Only run tests that failed in the journalled run\n"
+"    --pmc[=[<label>=]<event>,...]  -- Count hwpmc events during each test\n"
+"        (default: " CHERITEST_PMC_DEFAULT ")\n"
+#endif
 	     );
 	exit(EX_USAGE);
 }
@@ -1342,37 +1623,41 @@ usage(void)
 static void
 list_tests(void)
 {
-	u_int i;
+	const struct cheri_test **tests, *ctp;
+	u_int i, ntests;
 	const char *xfail_reason;
 
+	tests = calloc(cheri_tests_len, sizeof(*tests));
+	if (tests == NULL)
+		err(EX_OSERR, "calloc");
+	ntests = cheritest_list_select(tests);
+
 	xo_open_container("testsuite");
 	xo_open_list("test");
-	for (i = 0; i < cheri_tests_len; i++) {
-		if (fast_tests_only &&
-		    (cheri_tests[i].ct_flags & CT_FLAG_SLOW))
-			continue;
-		if (unsandboxed_tests_only &&
-		    (cheri_tests[i].ct_flags & CT_FLAG_SANDBOX))
-			continue;
+	for (i = 0; i < ntests; i++) {
+		ctp = tests[i];
 		xo_open_instance("test");
 		if (verbose)
 			xo_emit("{cw:name/%s}{:description/%s}",
-			    cheri_tests[i].ct_name,
-			    cheri_tests[i].ct_desc);
+			    ctp->ct_name, ctp->ct_desc);
 		else
 			xo_emit("{:name/%s}{e:description/%s}",
-			    cheri_tests[i].ct_name,
-			    cheri_tests[i].ct_desc);
-		if (cheri_tests[i].ct_check_xfail)
-			xfail_reason = cheri_tests[i].ct_check_xfail(
-			    cheri_tests[i].ct_name);
+			    ctp->ct_name, ctp->ct_desc);
+		if (ctp->ct_check_xfail)
+			xfail_reason = ctp->ct_check_xfail(ctp->ct_name);
 		else
-			xfail_reason = cheri_tests[i].ct_xfail_reason;
+			xfail_reason = ctp->ct_xfail_reason;
 		if (xfail_reason)
 			xo_emit("{e:expected-failure-reason/%s}",
 			    xfail_reason);
-		if (cheri_tests[i].ct_flags & CT_FLAG_SLOW)
+		if (ctp->ct_flags & CT_FLAG_SLOW)
 			xo_emit("{e:timeout/%s}", "LONG");
+		if (cheritest_tags[ctp - cheri_tests] & CHERITEST_TAG_PURECAP)
+			xo_emit("{e:purecap-only/%s}", "true");
+		if (cheritest_tags[ctp - cheri_tests] & CHERITEST_TAG_BENCH)
+			xo_emit("{e:benchmark/%s}", "true");
+		if (shard_count != 0)
+			xo_emit("{e:shard/%u}", shard_index);
 		xo_emit("\n");
 		xo_close_instance("test");
 	}
@@ -1450,6 +1735,7 @@ signal_handler(int signum, siginfo_t *info, void *vuap)
 		 * test.  Use EX_SOFTWARE as the parent handler will recognise
 		 * this as an appropriate exit code when a signal is handled.
 		 */
+		cheritest_pmc_stop();
 		_exit(EX_SOFTWARE);
 	}
 }
@@ -1478,217 +1764,3890 @@ set_thread_tracing(void)
 	if (error)
 		err(EX_OSERR, "QEMU_SET_QTRACE");
 }
+#endif
 
-/* Maximum size of stdout data we will check if called for by a test. */
-#define	TEST_BUFFER_LEN	1024
+/*
+ * Sets of tests, indexed by position in cheri_tests[]: one for each tag,
+ * and those excluded by -f and -u.
+ */
+struct cheritest_set {
+	uint64_t	cs_bits[howmany(CHERITEST_NTESTS, 64)];
+};
 
-static void
-cheritest_run_test(const struct cheri_test *ctp)
+static struct cheritest_set cheritest_tag_sets[CHERITEST_NTAGS];
+static struct cheritest_set cheritest_excluded;
+
+static inline int
+cheritest_set_isset(const struct cheritest_set *csp, u_int t)
 {
-	struct sigaction sa;
-	pid_t childpid;
-	int status, pipefd_stdin[2], pipefd_stdout[2];
-	char reason[TESTRESULT_STR_LEN * 2]; /* Potential output, plus some extra */
-	char visreason[sizeof(reason) * 4]; /* Space for vis(3) the string */
-	char buffer[TEST_BUFFER_LEN];
-	const char *xfail_reason;
-	char* failure_message;
-	register_t cp2_exccode, mips_exccode;
-	ssize_t len;
 
-	xo_open_instance("test");
-	bzero(ccsp, sizeof(*ccsp));
-	xo_emit("TEST: {:name/%s}: {:description/%s}\n",
-	   ctp->ct_name, ctp->ct_desc);
+	return ((csp->cs_bits[t / 64] & ((uint64_t)1 << (t % 64))) != 0);
+}
 
-	if (ctp->ct_check_xfail != NULL)
-		xfail_reason = ctp->ct_check_xfail(ctp->ct_name);
-	else
-		xfail_reason = ctp->ct_xfail_reason;
-	if (xfail_reason != NULL) {
-		xo_emit("{e:expected-failure-reason/%s}",
-		    xfail_reason);
-		expected_failures++;
-	}
+static inline void
+cheritest_set_add(struct cheritest_set *csp, u_int t)
+{
 
-	if (pipe(pipefd_stdin) < 0)
-		err(EX_OSERR, "pipe");
-	if (pipe(pipefd_stdout) < 0)
-		err(EX_OSERR, "pipe");
+	csp->cs_bits[t / 64] |= (uint64_t)1 << (t % 64);
+}
 
-	/* If stdin is to be filled, fill it. */
-	if (ctp->ct_flags & CT_FLAG_STDIN_STRING) {
-		len = write(pipefd_stdin[1], ctp->ct_stdin_string,
-		    strlen(ctp->ct_stdin_string));
-		if (len < 0) {
-			snprintf(reason, sizeof(reason),
-			    "write() on test stdin failed with -1 (%d)",
-			    errno);
-			goto fail;
-		}
-		if (len != (ssize_t)strlen(ctp->ct_stdin_string)) {
-			snprintf(reason, sizeof(reason),
-			    "write() on test stdin expected %lu but got %ld",
-			    strlen(ctp->ct_stdin_string), len);
-			goto fail;
+static inline void
+cheritest_set_union(struct cheritest_set *dst, const struct cheritest_set *src)
+{
+	u_int w;
+
+	for (w = 0; w < nitems(dst->cs_bits); w++)
+		dst->cs_bits[w] |= src->cs_bits[w];
+}
+
+static inline const struct cheritest_set *
+cheritest_tag_set(u_int tag)
+{
+
+	return (&cheritest_tag_sets[ffs(tag) - 1]);
+}
+
+/*
+ * Build the per-tag sets from cheritest_tags[], and the set of tests
+ * excluded by the command-line filtering options.
+ */
+static void
+cheritest_sets_init(void)
+{
+	u_int tag, t;
+
+	for (t = 0; t < cheri_tests_len; t++) {
+		for (tag = 0; tag < CHERITEST_NTAGS; tag++) {
+			if (cheritest_tags[t] & (1 << tag))
+				cheritest_set_add(&cheritest_tag_sets[tag], t);
 		}
+		assert(!(cheritest_tags[t] & CHERITEST_TAG_SANDBOX) ==
+		    !(cheri_tests[t].ct_flags & CT_FLAG_SANDBOX));
+		assert(!(cheritest_tags[t] & CHERITEST_TAG_SLOW) ==
+		    !(cheri_tests[t].ct_flags & CT_FLAG_SLOW));
+		assert(!(cheritest_tags[t] & CHERITEST_TAG_BENCH) ==
+		    !(cheri_tests[t].ct_flags & CT_FLAG_BENCH));
 	}
+	if (fast_tests_only)
+		cheritest_set_union(&cheritest_excluded,
+		    cheritest_tag_set(CHERITEST_TAG_SLOW));
+	if (unsandboxed_tests_only)
+		cheritest_set_union(&cheritest_excluded,
+		    cheritest_tag_set(CHERITEST_TAG_SANDBOX));
+}
 
-	/*
-	 * Flush stdout and stderr before forking so that we don't risk seeing
-	 * the output again in the child process, which could confuse the test
-	 * framework.
-	 */
-	fflush(stdout);
-	fflush(stderr);
+static uint32_t
+cheritest_name_hash(const char *name, uint32_t mult)
+{
+	uint64_t h;
 
-	/*
-	 * Create a child process with suitable signal handling and stdio set
-	 * up; execute the test case.
-	 */
-	childpid = fork();
-	if (childpid < 0)
-		err(EX_OSERR, "fork");
-	if (childpid == 0) {
-		/* Install signal handlers. */
-		sa.sa_sigaction = signal_handler;
-		sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
-		sigemptyset(&sa.sa_mask);
-		if (sigaction(SIGALRM, &sa, NULL) < 0)
-			err(EX_OSERR, "sigaction(SIGALRM)");
-		if (sigaction(SIGPROT, &sa, NULL) < 0)
-			err(EX_OSERR, "sigaction(SIGPROT)");
-		if (sigaction(SIGSEGV, &sa, NULL) < 0)
-			err(EX_OSERR, "sigaction(SIGSEGV)");
-		if (sigaction(SIGBUS, &sa, NULL) < 0)
-			err(EX_OSERR, "sigaction(SIGBUS");
-		if (sigaction(SIGEMT, &sa, NULL) < 0)
-			err(EX_OSERR, "sigaction(SIGEMT)");
-		if (sigaction(SIGTRAP, &sa, NULL) < 0)
-			err(EX_OSERR, "sigaction(SIGEMT)");
+	h = 0;
+	for (; *name != '\0'; name++)
+		h = (h * mult + (u_char)*name) % CHERITEST_HASH_PRIME;
+	return (h);
+}
 
-		/*
-		 * Set up synthetic stdin and stdout.
-		 */
-		if (dup2(pipefd_stdin[0], STDIN_FILENO) < 0)
-			err(EX_OSERR, "dup2(STDIN_FILENO)");
-		if (dup2(pipefd_stdout[1], STDOUT_FILENO) < 0)
-			err(EX_OSERR, "dup2(STDOUT_FILENO)");
-		close(pipefd_stdin[0]);
-		close(pipefd_stdin[1]);
-		close(pipefd_stdout[0]);
-		close(pipefd_stdout[1]);
+static const struct cheri_test *
+cheritest_find_test(const char *name)
+{
+	uint32_t bucket, slot;
+	u_int i;
 
-		if (qtrace)
-			set_thread_tracing();
+	bucket = cheritest_name_hash(name, CHERITEST_HASH_MULT) %
+	    CHERITEST_HASH_BUCKETS;
+	slot = cheritest_name_hash(name, cheritest_hash_mults[bucket]) %
+	    CHERITEST_HASH_SLOTS;
+	i = cheritest_hash_slots[slot];
+	if (i != 0 && strcmp(name, cheri_tests[i - 1].ct_name) == 0)
+		return (&cheri_tests[i - 1]);
+	return (NULL);
+}
 
-		/* Run the actual test. */
-		if (ctp->ct_arg != 0)
-			ctp->ct_func_arg(ctp, ctp->ct_arg);
-		else
-			ctp->ct_func(ctp);
-		exit(0);
-	}
-	close(pipefd_stdin[0]);
-	close(pipefd_stdout[1]);
-	if (fcntl(pipefd_stdout[0], F_SETFL, O_NONBLOCK) < 0)
-		err(EX_OSERR, "fcntl(F_SETFL, O_NONBLOCK) on test stdout");
-	(void)waitpid(childpid, &status, 0);
+/*
+ * Test duration history, used to start the longest tests first when running
+ * tests concurrently, to estimate the time remaining, and to balance shards
+ * (--shard) when given explicitly with -H.  The history file
+ * holds one line per test, "<binary>@<build> <test> <usecs>", where <binary>
+ * distinguishes, e.g., cheritest from cheriabitest, and <build> identifies
+ * the build of it that recorded the line: durations measured by one build
+ * say little about another.  Lines for other binaries, or for tests unknown
+ * to this one, are preserved when the file is rewritten; those for other
+ * builds of this binary are dropped.  Listing (LIST_ONLY) runs on the build
+ * host, so it can't identify the build and uses any line for the binary.
+ */
+#define	CHERITEST_HISTORY_PATH		"/var/tmp/cheritest.history"
 
-	/*
-	 * First, check for errors from the test framework: successful process
-	 * termination, signal disposition/exception codes/etc.
-	 *
-	 * Analyse child's signal state returned via shared memory.
-	 */
-	if (!WIFEXITED(status)) {
-		snprintf(reason, sizeof(reason), "Child exited abnormally");
-		goto fail;
-	}
-	if (WEXITSTATUS(status) != 0 && WEXITSTATUS(status) != EX_SOFTWARE) {
-		snprintf(reason, sizeof(reason), "Child status %d",
-		    WEXITSTATUS(status));
-		goto fail;
+/* Estimates for tests without history, in microseconds. */
+#define	CHERITEST_ESTIMATE_DEFAULT	100000
+#define	CHERITEST_ESTIMATE_SLOW		10000000
+
+#define	CHERITEST_MAX_SHARDS		1024
+
+static const char *history_path = CHERITEST_HISTORY_PATH;
+static const char *history_build;	/* NULL: any. */
+static int history_explicit;
+static u_int *cheri_tests_history;	/* Microseconds; 0: unknown. */
+static StringList *cheri_history_other;
+
+#ifndef LIST_ONLY
+static uint64_t
+cheritest_now_usec(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		err(EX_OSERR, "clock_gettime");
+	return ((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+static uint64_t
+cheritest_now_nsec(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		err(EX_OSERR, "clock_gettime");
+	return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+#endif
+
+#ifndef LIST_ONLY
+/*
+ * Format the GNU build ID of the ELF executable open on 'fd' into 'buf' as
+ * hex.  Returns -1 if it has none.
+ */
+static int
+cheritest_build_id(int fd, char *buf, size_t buflen)
+{
+	Elf_Ehdr ehdr;
+	Elf_Phdr phdr;
+	Elf_Note note;
+	u_char desc[64];
+	char name[sizeof("GNU")];
+	off_t end, off;
+	u_int i, j;
+
+	if (pread(fd, &ehdr, sizeof(ehdr), 0) != sizeof(ehdr) ||
+	    !IS_ELF(ehdr) || ehdr.e_phentsize != sizeof(phdr))
+		return (-1);
+	for (i = 0; i < ehdr.e_phnum; i++) {
+		if (pread(fd, &phdr, sizeof(phdr), ehdr.e_phoff +
+		    i * sizeof(phdr)) != sizeof(phdr))
+			return (-1);
+		if (phdr.p_type != PT_NOTE)
+			continue;
+		off = phdr.p_offset;
+		end = off + phdr.p_filesz;
+		while (off + (off_t)sizeof(note) <= end) {
+			if (pread(fd, &note, sizeof(note), off) !=
+			    sizeof(note))
+				return (-1);
+			off += sizeof(note);
+			if (note.n_type == NT_GNU_BUILD_ID &&
+			    note.n_namesz == sizeof(name) &&
+			    note.n_descsz <= sizeof(desc) &&
+			    note.n_descsz * 2 < buflen &&
+			    pread(fd, name, sizeof(name), off) ==
+			    sizeof(name) && memcmp(name, "GNU", 4) == 0 &&
+			    pread(fd, desc, note.n_descsz,
+			    off + roundup2(note.n_namesz, 4)) ==
+			    note.n_descsz) {
+				for (j = 0; j < note.n_descsz; j++)
+					snprintf(buf + 2 * j, 3, "%02x",
+					    desc[j]);
+				return (0);
+			}
+			off += roundup2(note.n_namesz, 4) +
+			    roundup2(note.n_descsz, 4);
+		}
 	}
-	if (ccsp->ccs_signum < 0) {
-		snprintf(reason, sizeof(reason),
-		    "Child returned negative signal %d", ccsp->ccs_signum);
-		goto fail;
+	return (-1);
+}
+
+/*
+ * Identify this build of the binary in the history file: by its build ID,
+ * which is the same wherever it is installed, so that a history file can be
+ * shared between the machines running the shards of a run; failing that,
+ * by the inode and modification time of the executable.  Returns NULL if
+ * the executable can't be found, in which case no history is kept.
+ */
+static const char *
+cheritest_history_build(void)
+{
+	static char build[2 * 64 + 1];
+	char path[PATH_MAX];
+	struct stat sb;
+	size_t len;
+	int fd, mib[4];
+
+	mib[0] = CTL_KERN;
+	mib[1] = KERN_PROC;
+	mib[2] = KERN_PROC_PATHNAME;
+	mib[3] = -1;
+	len = sizeof(path);
+	if (sysctl(mib, nitems(mib), path, &len, NULL, 0) < 0) {
+		warn("sysctl(kern.proc.pathname)");
+		return (NULL);
 	}
-	if (ctp->ct_flags & (CT_FLAG_SIGNAL | CT_FLAG_SIGNAL_UNWIND) &&
-	    ccsp->ccs_signum != ctp->ct_signum) {
-		snprintf(reason, sizeof(reason), "Expected signal %d, got %d",
-		    ctp->ct_signum, ccsp->ccs_signum);
-		goto fail;
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		warn("%s", path);
+		return (NULL);
 	}
-	if ((ctp->ct_flags & CT_FLAG_SI_CODE) &&
-	    ccsp->ccs_si_code != ctp->ct_si_code) {
-		snprintf(reason, sizeof(reason), "Expected si_code %d, got %d",
-		    ctp->ct_si_code, ccsp->ccs_si_code);
-		goto fail;
+	if (cheritest_build_id(fd, build, sizeof(build)) < 0) {
+		if (fstat(fd, &sb) < 0)
+			err(EX_OSERR, "fstat: %s", path);
+		snprintf(build, sizeof(build), "%ju.%jd",
+		    (uintmax_t)sb.st_ino, (intmax_t)sb.st_mtime);
 	}
-	if ((ctp->ct_flags & CT_FLAG_SIGNAL_UNWIND) && !ccsp->ccs_unwound) {
-		snprintf(reason, sizeof(reason), "Expected trusted stack "
-		   "unwind, but none seen");
-		goto fail;
+	close(fd);
+	return (build);
+}
+#endif
+
+static void
+cheritest_history_load(void)
+{
+	const struct cheri_test *ctp;
+	const char *binary, *build, *name, *errstr;
+	char *line, *p, *copy;
+	size_t linecap;
+	u_int usec;
+	FILE *fp;
+
+	cheri_tests_history = calloc(cheri_tests_len,
+	    sizeof(*cheri_tests_history));
+	if (cheri_tests_history == NULL)
+		err(EX_OSERR, "calloc");
+	cheri_history_other = sl_init();
+	if (history_path[0] == '\0')
+		return;
+#ifndef LIST_ONLY
+	history_build = cheritest_history_build();
+	if (history_build == NULL) {
+		history_path = "";
+		return;
 	}
-	if (!(ctp->ct_flags & CT_FLAG_SIGNAL_UNWIND) && ccsp->ccs_unwound) {
-		snprintf(reason, sizeof(reason), "Unexpected trusted stack "
-		    "unwind");
-		goto fail;
+#endif
+	fp = fopen(history_path, "r");
+	if (fp == NULL) {
+		if (errno != ENOENT)
+			warn("%s", history_path);
+		return;
 	}
-	if (ctp->ct_flags & CT_FLAG_MIPS_EXCCODE) {
-		mips_exccode = (ccsp->ccs_mips_cause & MIPS_CR_EXC_CODE) >>
-		    MIPS_CR_EXC_CODE_SHIFT;
-		if (mips_exccode != ctp->ct_mips_exccode) {
-			snprintf(reason, sizeof(reason),
-			    "Expected MIPS exccode %ju, got %ju",
-			    ctp->ct_mips_exccode, mips_exccode);
-			goto fail;
+	line = NULL;
+	linecap = 0;
+	while (getline(&line, &linecap, fp) > 0) {
+		line[strcspn(line, "\n")] = '\0';
+		copy = strdup(line);
+		if (copy == NULL)
+			err(EX_OSERR, "strdup");
+		p = line;
+		build = strsep(&p, " ");
+		name = strsep(&p, " ");
+		binary = strsep(&build, "@");
+		if (name == NULL || p == NULL || build == NULL) {
+			/* Malformed, or from before builds were recorded. */
+			free(copy);
+			continue;
 		}
-	}
-	if (ctp->ct_flags & CT_FLAG_CP2_EXCCODE) {
-		cp2_exccode = (ccsp->ccs_cp2_cause &
-		    CHERI_CAPCAUSE_EXCCODE_MASK) >>
-		    CHERI_CAPCAUSE_EXCCODE_SHIFT;
-		if (cp2_exccode != ctp->ct_cp2_exccode) {
-			snprintf(reason, sizeof(reason),
-			    "Expected CP2 exccode %ju, got %ju",
-			    ctp->ct_cp2_exccode, cp2_exccode);
-			goto fail;
+		if (strcmp(binary, getprogname()) == 0) {
+			/* Drop lines recorded by other builds. */
+			if (history_build != NULL &&
+			    strcmp(build, history_build) != 0) {
+				free(copy);
+				continue;
+			}
+			ctp = cheritest_find_test(name);
+			usec = strtonum(p, 1, UINT_MAX, &errstr);
+			if (ctp != NULL && errstr == NULL) {
+				cheri_tests_history[ctp - cheri_tests] = usec;
+				free(copy);
+				continue;
+			}
 		}
+		sl_add(cheri_history_other, copy);
 	}
+	free(line);
+	fclose(fp);
+}
 
-	/*
-	 * Next, see whether any expected output was present.
-	 */
-	len = read(pipefd_stdout[0], buffer, sizeof(buffer) - 1);
-	if (len < 0) {
-		xo_attr("error", strerror(errno));
-		xo_emit("{e:stdout/%s}", "");
-	} else {
-		buffer[len] = '\0';
-		if (len > 0) {
-			if (ctp->ct_flags & CT_FLAG_STDOUT_IGNORE)
-				xo_attr("ignored", "true");
-			xo_emit("{e:stdout/%s}", buffer);
-		}
-	}
-	if (ctp->ct_flags & CT_FLAG_STDOUT_STRING) {
-		xo_emit("{e:expected-stdout/%s}", ctp->ct_stdout_string);
-		if (len < 0) {
-			snprintf(reason, sizeof(reason),
-			    "read() on test stdout failed with -1 (%d)",
-			    errno);
+#ifndef LIST_ONLY
+/*
+ * Record a new sample of a test's duration, smoothing out noise with an
+ * exponentially-weighted moving average.
+ */
+static void
+cheritest_history_update(const struct cheri_test *ctp, uint64_t usec)
+{
+	u_int *histp;
+
+	histp = &cheri_tests_history[ctp - cheri_tests];
+	usec = MAX(usec, 1);
+	if (*histp == 0)
+		*histp = MIN(usec, UINT_MAX);
+	else
+		*histp = MIN((3 * (uint64_t)*histp + usec) / 4, UINT_MAX);
+}
+
+/*
+ * Rewrite the history file.  Failure is not fatal, as the history only
+ * affects scheduling.
+ */
+static void
+cheritest_history_save(void)
+{
+	char *tmppath;
+	size_t i;
+	u_int t;
+	FILE *fp;
+	int fd;
+
+	if (history_path[0] == '\0')
+		return;
+	if (asprintf(&tmppath, "%s.XXXXXX", history_path) < 0)
+		err(EX_OSERR, "asprintf");
+	fd = mkstemp(tmppath);
+	if (fd < 0) {
+		warn("%s", tmppath);
+		free(tmppath);
+		return;
+	}
+	fp = fdopen(fd, "w");
+	if (fp == NULL)
+		err(EX_OSERR, "fdopen");
+	for (i = 0; i < cheri_history_other->sl_cur; i++)
+		fprintf(fp, "%s\n", cheri_history_other->sl_str[i]);
+	for (t = 0; t < cheri_tests_len; t++) {
+		if (cheri_tests_history[t] == 0)
+			continue;
+		fprintf(fp, "%s@%s %s %u\n", getprogname(), history_build,
+		    cheri_tests[t].ct_name, cheri_tests_history[t]);
+	}
+	if (fclose(fp) != 0) {
+		warn("%s", tmppath);
+		unlink(tmppath);
+	} else if (rename(tmppath, history_path) < 0) {
+		warn("rename: %s", history_path);
+		unlink(tmppath);
+	}
+	free(tmppath);
+}
+#endif /* !LIST_ONLY */
+
+/*
+ * Expected duration of a test, in microseconds, from its history if
+ * 'use_history' is set and there is any, otherwise from its flags.
+ */
+static uint64_t
+cheritest_estimate(const struct cheri_test *ctp, int use_history)
+{
+	u_int usec;
+
+	if (use_history && cheri_tests_history != NULL) {
+		usec = cheri_tests_history[ctp - cheri_tests];
+		if (usec != 0)
+			return (usec);
+	}
+	if (ctp->ct_flags & CT_FLAG_SLOW)
+		return (CHERITEST_ESTIMATE_SLOW);
+	return (CHERITEST_ESTIMATE_DEFAULT);
+}
+
+struct cheritest_shard_entry {
+	u_int		 cse_pos;	/* Index into the selected tests. */
+	uint64_t	 cse_cost;
+};
+
+static int
+cheritest_shard_compare(const void *a, const void *b)
+{
+	const struct cheritest_shard_entry *csea, *cseb;
+
+	csea = a;
+	cseb = b;
+	if (csea->cse_cost != cseb->cse_cost)
+		return (csea->cse_cost > cseb->cse_cost ? -1 : 1);
+	return (csea->cse_pos < cseb->cse_pos ? -1 : 1);
+}
+
+/*
+ * Reduce 'tests' to those in the selected shard, preserving their order,
+ * and return the number remaining.  Tests are assigned, longest first, to
+ * the shard with least expected work so far.  To ensure that every test is
+ * run in exactly one shard, the assignment depends only on the tests
+ * selected and, if given with -H, the history file: the same options and
+ * history must be used for each shard.
+ */
+static u_int
+cheritest_shard(const struct cheri_test **tests, u_int ntests)
+{
+	struct cheritest_shard_entry *entries;
+	uint64_t *loads;
+	u_int *assigned;
+	u_int i, n, s, min;
+
+	entries = calloc(ntests, sizeof(*entries));
+	assigned = calloc(ntests, sizeof(*assigned));
+	loads = calloc(shard_count, sizeof(*loads));
+	if (entries == NULL || assigned == NULL || loads == NULL)
+		err(EX_OSERR, "calloc");
+	for (i = 0; i < ntests; i++) {
+		entries[i].cse_pos = i;
+		entries[i].cse_cost = cheritest_estimate(tests[i],
+		    history_explicit);
+	}
+	qsort(entries, ntests, sizeof(*entries), cheritest_shard_compare);
+	for (i = 0; i < ntests; i++) {
+		min = 0;
+		for (s = 1; s < shard_count; s++) {
+			if (loads[s] < loads[min])
+				min = s;
+		}
+		loads[min] += entries[i].cse_cost;
+		assigned[entries[i].cse_pos] = min + 1;
+	}
+	n = 0;
+	for (i = 0; i < ntests; i++) {
+		if (assigned[i] == shard_index)
+			tests[n++] = tests[i];
+	}
+	free(loads);
+	free(assigned);
+	free(entries);
+	return (n);
+}
+
+/* Parse the argument to --shard, "i/n". */
+static void
+cheritest_parse_shard(const char *arg)
+{
+	const char *errstr;
+	char *copy, *index, *p;
+
+	copy = strdup(arg);
+	if (copy == NULL)
+		err(EX_OSERR, "strdup");
+	p = copy;
+	index = strsep(&p, "/");
+	if (p == NULL)
+		errx(EX_USAGE, "--shard %s: expected <i>/<n>", arg);
+	shard_count = strtonum(p, 1, CHERITEST_MAX_SHARDS, &errstr);
+	if (errstr != NULL)
+		errx(EX_USAGE, "--shard %s: count %s", arg, errstr);
+	shard_index = strtonum(index, 1, shard_count, &errstr);
+	if (errstr != NULL)
+		errx(EX_USAGE, "--shard %s: index %s", arg, errstr);
+	free(copy);
+}
+
+/*
+ * Fill 'tests' with those to be listed, after -f, -u and --shard filtering,
+ * and return their number.
+ */
+static u_int
+cheritest_list_select(const struct cheri_test **tests)
+{
+	u_int i, ntests;
+
+	ntests = 0;
+	for (i = 0; i < cheri_tests_len; i++) {
+		if (!cheritest_set_isset(&cheritest_excluded, i))
+			tests[ntests++] = &cheri_tests[i];
+	}
+	if (shard_count != 0) {
+		if (history_explicit)
+			cheritest_history_load();
+		ntests = cheritest_shard(tests, ntests);
+	}
+	return (ntests);
+}
+
+/*
+ * Outcome of a test, as recorded in the journals.
+ */
+#define	CHERITEST_RESULT_NONE		0
+#define	CHERITEST_RESULT_PASS		1
+#define	CHERITEST_RESULT_XFAIL		2	/* Failed, as expected. */
+#define	CHERITEST_RESULT_FAIL		3
+#define	CHERITEST_RESULT_TIMEOUT	4
+
+static const char *cheritest_result_names[] = {
+	[CHERITEST_RESULT_PASS] = "PASS",
+	[CHERITEST_RESULT_XFAIL] = "XFAIL",
+	[CHERITEST_RESULT_FAIL] = "FAIL",
+	[CHERITEST_RESULT_TIMEOUT] = "TIMEOUT",
+};
+
+/*
+ * Resources used by a test's process, from wait4(), or for a test run by a
+ * batch worker, the difference in the worker's usage across the test; max
+ * RSS is the peak for the process either way.
+ */
+struct cheritest_rusage {
+	uint64_t	cru_utime_usec;
+	uint64_t	cru_stime_usec;
+	uint64_t	cru_maxrss_kb;
+	uint64_t	cru_minflt;
+	uint64_t	cru_majflt;
+	uint64_t	cru_nvcsw;
+	uint64_t	cru_nivcsw;
+	uint64_t	cru_inblock;
+	uint64_t	cru_oublock;
+};
+
+/*
+ * Add a test's resource usage to a total; max RSS is the peak of any test.
+ */
+static void
+cheritest_rusage_add(struct cheritest_rusage *total,
+    const struct cheritest_rusage *crup)
+{
+
+	total->cru_utime_usec += crup->cru_utime_usec;
+	total->cru_stime_usec += crup->cru_stime_usec;
+	total->cru_maxrss_kb = MAX(total->cru_maxrss_kb, crup->cru_maxrss_kb);
+	total->cru_minflt += crup->cru_minflt;
+	total->cru_majflt += crup->cru_majflt;
+	total->cru_nvcsw += crup->cru_nvcsw;
+	total->cru_nivcsw += crup->cru_nivcsw;
+	total->cru_inblock += crup->cru_inblock;
+	total->cru_oublock += crup->cru_oublock;
+}
+
+/*
+ * Emit resource usage as a container named 'name'.
+ */
+static void
+cheritest_emit_rusage(const char *name, const struct cheritest_rusage *crup)
+{
+
+	xo_open_container(name);
+	xo_emit("{e:user-us/%ju}{e:system-us/%ju}{e:max-rss-kb/%ju}"
+	    "{e:minor-faults/%ju}{e:major-faults/%ju}"
+	    "{e:voluntary-csw/%ju}{e:involuntary-csw/%ju}"
+	    "{e:block-in/%ju}{e:block-out/%ju}",
+	    (uintmax_t)crup->cru_utime_usec, (uintmax_t)crup->cru_stime_usec,
+	    (uintmax_t)crup->cru_maxrss_kb, (uintmax_t)crup->cru_minflt,
+	    (uintmax_t)crup->cru_majflt, (uintmax_t)crup->cru_nvcsw,
+	    (uintmax_t)crup->cru_nivcsw, (uintmax_t)crup->cru_inblock,
+	    (uintmax_t)crup->cru_oublock);
+	xo_close_container(name);
+}
+
+/*
+ * Timings of a benchmark's batches, each of cb_iterations runs of its
+ * kernel, and the cycles that they took, if counted with --pmc.  The
+ * median and 90th percentile are of the cb_batches batches' totals, not of
+ * individual runs, which are too short to time on their own.
+ */
+struct cheritest_bench {
+	uint64_t	cb_iterations;
+	uint64_t	cb_nsec_min;
+	uint64_t	cb_nsec_median;
+	uint64_t	cb_nsec_p90;
+	uint64_t	cb_nsec_max;
+	uint64_t	cb_batches;
+	uint64_t	cb_cycles_min;		/* 0: not counted. */
+	uint64_t	cb_cycles_median;
+	uint64_t	cb_cycles_p90;
+	uint64_t	cb_cycles_max;
+};
+
+/*
+ * Format num / den to three decimal places.
+ */
+static void
+cheritest_bench_format(char *buf, size_t len, uint64_t num, uint64_t den)
+{
+	uint64_t milli;
+
+	milli = num * 1000 / MAX(den, 1);
+	snprintf(buf, len, "%ju.%03ju", (uintmax_t)(milli / 1000),
+	    (uintmax_t)(milli % 1000));
+}
+
+static void
+cheritest_emit_bench(const char *name, const struct cheritest_bench *cbp)
+{
+	char best[32], median[32], p90[32], worst[32];
+	uint64_t iterations;
+
+	iterations = cbp->cb_iterations;
+	cheritest_bench_format(median, sizeof(median), cbp->cb_nsec_median,
+	    iterations);
+	cheritest_bench_format(best, sizeof(best), cbp->cb_nsec_min,
+	    iterations);
+	cheritest_bench_format(p90, sizeof(p90), cbp->cb_nsec_p90,
+	    iterations);
+	cheritest_bench_format(worst, sizeof(worst), cbp->cb_nsec_max,
+	    iterations);
+	xo_open_container("benchmark");
+	xo_emit("BENCH: {d:name/%s}: {:ns-per-op/%s} ns/op, "
+	    "{:ops-per-sec/%ju} ops/s (best {:best-ns-per-op/%s}, "
+	    "batch p90 {:batch-p90-ns-per-op/%s}, "
+	    "worst {:worst-ns-per-op/%s} ns/op; "
+	    "{:batches/%ju} batches of {:iterations/%ju})\n", name, median,
+	    (uintmax_t)(iterations * 1000000000 /
+	    MAX(cbp->cb_nsec_median, 1)), best, p90, worst,
+	    (uintmax_t)cbp->cb_batches, (uintmax_t)iterations);
+	if (cbp->cb_cycles_median != 0) {
+		cheritest_bench_format(median, sizeof(median),
+		    cbp->cb_cycles_median, iterations);
+		cheritest_bench_format(best, sizeof(best),
+		    cbp->cb_cycles_min, iterations);
+		cheritest_bench_format(p90, sizeof(p90), cbp->cb_cycles_p90,
+		    iterations);
+		cheritest_bench_format(worst, sizeof(worst),
+		    cbp->cb_cycles_max, iterations);
+		xo_emit("BENCH: {d:name/%s}: {:cycles-per-op/%s} cycles/op "
+		    "(best {:best-cycles-per-op/%s}, "
+		    "batch p90 {:batch-p90-cycles-per-op/%s}, "
+		    "worst {:worst-cycles-per-op/%s})\n", name, median, best,
+		    p90, worst);
+	}
+	xo_close_container("benchmark");
+}
+
+/*
+ * A reported test result, from which both the test's structured output and
+ * its binary journal record are produced.  Strings are NULL when absent.
+ */
+struct cheritest_result {
+	const char	*cr_name;
+	const char	*cr_desc;
+	const char	*cr_reason;		/* Why the test failed. */
+	const char	*cr_xfail_reason;
+	const char	*cr_stdout;
+	const char	*cr_stdout_error;	/* Why stdout was not read. */
+	const char	*cr_expected_stdout;
+	uint64_t	 cr_usec;
+	int		 cr_result;		/* CHERITEST_RESULT_*. */
+	int		 cr_timedout;
+	int		 cr_stdout_ignored;
+	int		 cr_has_rusage;
+	struct cheritest_rusage	cr_rusage;
+	int		 cr_has_bench;
+	struct cheritest_bench	cr_bench;
+	const char	*cr_pmc_labels;		/* Comma-separated. */
+	u_int		 cr_pmc_valid;		/* Bit per counter. */
+	uint64_t	 cr_pmc[CHERITEST_PMC_MAX];
+};
+
+/*
+ * Emit the hardware counters read over a test, in text output too if
+ * verbose.
+ */
+static void
+cheritest_emit_pmc(const struct cheritest_result *crp)
+{
+	const char *label;
+	size_t len;
+	u_int i;
+
+	if (crp->cr_pmc_valid == 0 || crp->cr_pmc_labels == NULL)
+		return;
+	xo_open_list("pmc");
+	label = crp->cr_pmc_labels;
+	for (i = 0; i < CHERITEST_PMC_MAX && *label != '\0'; i++) {
+		len = strcspn(label, ",");
+		if (crp->cr_pmc_valid & (1 << i)) {
+			xo_open_instance("pmc");
+			xo_emit(verbose ? "  {:name/%.*s}: {:value/%ju}\n" :
+			    "{e:name/%.*s}{e:value/%ju}", (int)len, label,
+			    (uintmax_t)crp->cr_pmc[i]);
+			xo_close_instance("pmc");
+		}
+		label += len;
+		if (*label == ',')
+			label++;
+	}
+	xo_close_list("pmc");
+}
+
+/*
+ * Binary result journal (-B): rather than formatting each result as the
+ * test completes, the runner appends a fixed-size record to a file mapped
+ * shared, and --convert later produces the usual structured output, JUnit
+ * XML or TAP from it, on the host if need be.  The file is a header, space
+ * for a record for each selected test, and a heap of nul-terminated
+ * strings, referenced by offset; offset 0 is the empty string, taken to
+ * mean no string.  All fields are little-endian.  The header counts are
+ * updated after each record is written, so that an interrupted run leaves
+ * a usable journal.
+ */
+#define	CHERITEST_BJ_MAGIC	"CHTBJ001"
+#define	CHERITEST_BJ_HEAP_CHUNK	(64 * 1024)
+
+struct cheritest_bj_header {
+	char		cbh_magic[8];
+	uint32_t	cbh_record_size;
+	uint32_t	cbh_capacity;		/* Records space is left for. */
+	uint32_t	cbh_nrecords;
+	uint32_t	cbh_heap_len;
+};
+
+#define	CHERITEST_BJ_TIMEDOUT		0x1
+#define	CHERITEST_BJ_STDOUT_IGNORED	0x2
+#define	CHERITEST_BJ_RUSAGE		0x4	/* cbr_rusage is valid. */
+#define	CHERITEST_BJ_BENCH		0x8	/* cbr_bench is valid. */
+
+struct cheritest_bj_record {
+	uint32_t	cbr_test;		/* Index in cheri_tests[]. */
+	uint32_t	cbr_result;		/* CHERITEST_RESULT_*. */
+	uint32_t	cbr_flags;		/* CHERITEST_BJ_*. */
+	uint32_t	cbr_status;		/* From waitpid(). */
+	uint32_t	cbr_signum;
+	uint32_t	cbr_si_code;
+	uint64_t	cbr_mips_cause;
+	uint64_t	cbr_cp2_cause;
+	uint64_t	cbr_usec;
+	struct cheritest_rusage	cbr_rusage;
+	struct cheritest_bench	cbr_bench;
+	uint64_t	cbr_pmc[CHERITEST_PMC_MAX];
+
+	/* String heap offsets. */
+	uint32_t	cbr_name;
+	uint32_t	cbr_desc;
+	uint32_t	cbr_reason;
+	uint32_t	cbr_xfail_reason;
+	uint32_t	cbr_stdout;
+	uint32_t	cbr_stdout_error;
+	uint32_t	cbr_expected_stdout;
+	uint32_t	cbr_pmc_labels;
+
+	uint32_t	cbr_pmc_valid;		/* Bit per cbr_pmc[] entry. */
+	uint32_t	cbr_pad;
+};
+
+/*
+ * Convert between host and journal byte order; each is its own inverse.
+ */
+static uint32_t
+cheritest_bj_32(uint32_t v)
+{
+	const uint8_t *p;
+
+	p = (const uint8_t *)&v;
+	return ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+	    (uint32_t)p[3] << 24);
+}
+
+static uint64_t
+cheritest_bj_64(uint64_t v)
+{
+	const uint8_t *p;
+	uint64_t r;
+	int i;
+
+	p = (const uint8_t *)&v;
+	r = 0;
+	for (i = 7; i >= 0; i--)
+		r = r << 8 | p[i];
+	return (r);
+}
+
+/*
+ * Emit a test result in the form cheritest has always printed it, within
+ * a "test" instance opened by the caller.
+ */
+static void
+cheritest_emit_result(const struct cheritest_result *crp)
+{
+	const char *status_str;
+
+	xo_emit("TEST: {:name/%s}: {:description/%s}\n",
+	   crp->cr_name, crp->cr_desc);
+	xo_emit("{e:duration-us/%ju}", (uintmax_t)crp->cr_usec);
+	if (crp->cr_xfail_reason != NULL)
+		xo_emit("{e:expected-failure-reason/%s}",
+		    crp->cr_xfail_reason);
+	if (crp->cr_stdout_error != NULL) {
+		xo_attr("error", "%s", crp->cr_stdout_error);
+		xo_emit("{e:stdout/%s}", "");
+	} else if (crp->cr_stdout != NULL) {
+		if (crp->cr_stdout_ignored)
+			xo_attr("ignored", "true");
+		xo_emit("{e:stdout/%s}", crp->cr_stdout);
+	}
+	if (crp->cr_expected_stdout != NULL)
+		xo_emit("{e:expected-stdout/%s}", crp->cr_expected_stdout);
+	if (crp->cr_has_rusage)
+		cheritest_emit_rusage("rusage", &crp->cr_rusage);
+	cheritest_emit_pmc(crp);
+
+	if (crp->cr_result == CHERITEST_RESULT_PASS) {
+		if (crp->cr_xfail_reason == NULL)
+			xo_emit("{:status/%s}: {d:name/%s}\n", "PASS",
+			    crp->cr_name);
+		else {
+			xo_attr("expected", "false");
+			xo_emit("{:status/%s}: {d:name/%s} (Expected failure "
+			    "due to {d:expected-failure-reason/%s})\n",
+			    "PASS", crp->cr_name, crp->cr_xfail_reason);
+		}
+		if (crp->cr_has_bench)
+			cheritest_emit_bench(crp->cr_name, &crp->cr_bench);
+		return;
+	}
+	status_str = crp->cr_timedout ? "TIMEOUT" : "FAIL";
+	if (crp->cr_xfail_reason == NULL)
+		xo_emit("{:status/%s}: {d:name/%s}: {:failure-reason/%s}\n",
+		    status_str, crp->cr_name, crp->cr_reason);
+	else {
+		xo_attr("expected", "true");
+		xo_emit("{d:/%s}{:status/%s}: {d:name/%s}: "
+		    "{:failure-reason/%s} ({d:expected-failure-reason/%s})\n",
+		    "X", status_str, crp->cr_name, crp->cr_reason,
+		    crp->cr_xfail_reason);
+	}
+}
+
+/*
+ * A binary journal mapped for conversion.
+ */
+struct cheritest_bj_file {
+	const char				*cbf_path;
+	const struct cheritest_bj_record	*cbf_records;
+	const char				*cbf_heap;
+	uint32_t				 cbf_nrecords;
+	uint32_t				 cbf_heap_len;
+};
+
+static void
+cheritest_bj_load(const char *path, struct cheritest_bj_file *cbfp)
+{
+	const struct cheritest_bj_header *cbhp;
+	struct stat sb;
+	const char *base;
+	uint64_t heap_off;
+	uint32_t capacity;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		err(EX_NOINPUT, "%s", path);
+	if (fstat(fd, &sb) < 0)
+		err(EX_OSERR, "%s: fstat", path);
+	if ((size_t)sb.st_size < sizeof(*cbhp))
+		errx(EX_DATAERR, "%s: truncated header", path);
+	base = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED)
+		err(EX_OSERR, "%s: mmap", path);
+	close(fd);
+
+	cbhp = (const struct cheritest_bj_header *)base;
+	if (memcmp(cbhp->cbh_magic, CHERITEST_BJ_MAGIC,
+	    sizeof(cbhp->cbh_magic)) != 0)
+		errx(EX_DATAERR, "%s: not a binary journal", path);
+	if (cheritest_bj_32(cbhp->cbh_record_size) !=
+	    sizeof(struct cheritest_bj_record))
+		errx(EX_DATAERR, "%s: unexpected record size %u", path,
+		    cheritest_bj_32(cbhp->cbh_record_size));
+	capacity = cheritest_bj_32(cbhp->cbh_capacity);
+	cbfp->cbf_path = path;
+	cbfp->cbf_nrecords = cheritest_bj_32(cbhp->cbh_nrecords);
+	cbfp->cbf_heap_len = cheritest_bj_32(cbhp->cbh_heap_len);
+	heap_off = sizeof(*cbhp) +
+	    (uint64_t)capacity * sizeof(struct cheritest_bj_record);
+	if (cbfp->cbf_nrecords > capacity ||
+	    heap_off + cbfp->cbf_heap_len > (uint64_t)sb.st_size)
+		errx(EX_DATAERR, "%s: truncated", path);
+	cbfp->cbf_records = (const struct cheritest_bj_record *)(cbhp + 1);
+	cbfp->cbf_heap = base + heap_off;
+	if (cbfp->cbf_heap_len == 0 ||
+	    cbfp->cbf_heap[cbfp->cbf_heap_len - 1] != '\0')
+		errx(EX_DATAERR, "%s: corrupt string heap", path);
+}
+
+static const char *
+cheritest_bj_string(const struct cheritest_bj_file *cbfp, uint32_t off)
+{
+
+	off = cheritest_bj_32(off);
+	if (off == 0)
+		return (NULL);
+	if (off >= cbfp->cbf_heap_len)
+		errx(EX_DATAERR, "%s: string offset %u out of range",
+		    cbfp->cbf_path, off);
+	return (cbfp->cbf_heap + off);
+}
+
+/*
+ * Copy resource usage between host and journal byte order.
+ */
+static void
+cheritest_bj_rusage(struct cheritest_rusage *to,
+    const struct cheritest_rusage *from)
+{
+
+	to->cru_utime_usec = cheritest_bj_64(from->cru_utime_usec);
+	to->cru_stime_usec = cheritest_bj_64(from->cru_stime_usec);
+	to->cru_maxrss_kb = cheritest_bj_64(from->cru_maxrss_kb);
+	to->cru_minflt = cheritest_bj_64(from->cru_minflt);
+	to->cru_majflt = cheritest_bj_64(from->cru_majflt);
+	to->cru_nvcsw = cheritest_bj_64(from->cru_nvcsw);
+	to->cru_nivcsw = cheritest_bj_64(from->cru_nivcsw);
+	to->cru_inblock = cheritest_bj_64(from->cru_inblock);
+	to->cru_oublock = cheritest_bj_64(from->cru_oublock);
+}
+
+static void
+cheritest_bj_bench(struct cheritest_bench *to,
+    const struct cheritest_bench *from)
+{
+
+	to->cb_iterations = cheritest_bj_64(from->cb_iterations);
+	to->cb_nsec_min = cheritest_bj_64(from->cb_nsec_min);
+	to->cb_nsec_median = cheritest_bj_64(from->cb_nsec_median);
+	to->cb_nsec_p90 = cheritest_bj_64(from->cb_nsec_p90);
+	to->cb_nsec_max = cheritest_bj_64(from->cb_nsec_max);
+	to->cb_batches = cheritest_bj_64(from->cb_batches);
+	to->cb_cycles_min = cheritest_bj_64(from->cb_cycles_min);
+	to->cb_cycles_median = cheritest_bj_64(from->cb_cycles_median);
+	to->cb_cycles_p90 = cheritest_bj_64(from->cb_cycles_p90);
+	to->cb_cycles_max = cheritest_bj_64(from->cb_cycles_max);
+}
+
+static void
+cheritest_bj_result(const struct cheritest_bj_file *cbfp, uint32_t i,
+    struct cheritest_result *crp)
+{
+	const struct cheritest_bj_record *cbrp;
+	uint32_t flags;
+	u_int j;
+
+	cbrp = &cbfp->cbf_records[i];
+	crp->cr_name = cheritest_bj_string(cbfp, cbrp->cbr_name);
+	crp->cr_desc = cheritest_bj_string(cbfp, cbrp->cbr_desc);
+	crp->cr_reason = cheritest_bj_string(cbfp, cbrp->cbr_reason);
+	crp->cr_xfail_reason = cheritest_bj_string(cbfp,
+	    cbrp->cbr_xfail_reason);
+	crp->cr_stdout = cheritest_bj_string(cbfp, cbrp->cbr_stdout);
+	crp->cr_stdout_error = cheritest_bj_string(cbfp,
+	    cbrp->cbr_stdout_error);
+	crp->cr_expected_stdout = cheritest_bj_string(cbfp,
+	    cbrp->cbr_expected_stdout);
+	crp->cr_usec = cheritest_bj_64(cbrp->cbr_usec);
+	crp->cr_result = cheritest_bj_32(cbrp->cbr_result);
+	flags = cheritest_bj_32(cbrp->cbr_flags);
+	crp->cr_timedout = (flags & CHERITEST_BJ_TIMEDOUT) != 0;
+	crp->cr_stdout_ignored = (flags & CHERITEST_BJ_STDOUT_IGNORED) != 0;
+	crp->cr_has_rusage = (flags & CHERITEST_BJ_RUSAGE) != 0;
+	cheritest_bj_rusage(&crp->cr_rusage, &cbrp->cbr_rusage);
+	crp->cr_has_bench = (flags & CHERITEST_BJ_BENCH) != 0;
+	cheritest_bj_bench(&crp->cr_bench, &cbrp->cbr_bench);
+	crp->cr_pmc_labels = cheritest_bj_string(cbfp, cbrp->cbr_pmc_labels);
+	crp->cr_pmc_valid = cheritest_bj_32(cbrp->cbr_pmc_valid);
+	for (j = 0; j < CHERITEST_PMC_MAX; j++)
+		crp->cr_pmc[j] = cheritest_bj_64(cbrp->cbr_pmc[j]);
+	if (crp->cr_name == NULL || crp->cr_desc == NULL ||
+	    crp->cr_result < CHERITEST_RESULT_PASS ||
+	    crp->cr_result > CHERITEST_RESULT_TIMEOUT ||
+	    (crp->cr_result != CHERITEST_RESULT_PASS && crp->cr_reason == NULL))
+		errx(EX_DATAERR, "%s: corrupt record %u", cbfp->cbf_path, i);
+}
+
+/*
+ * Print a string with the characters special to XML escaped, and those
+ * it cannot represent replaced.
+ */
+static void
+cheritest_xml_print(const char *s)
+{
+
+	for (; *s != '\0'; s++) {
+		switch (*s) {
+		case '&':
+			fputs("&amp;", stdout);
+			break;
+		case '<':
+			fputs("&lt;", stdout);
+			break;
+		case '>':
+			fputs("&gt;", stdout);
+			break;
+		case '"':
+			fputs("&quot;", stdout);
+			break;
+		case '\'':
+			fputs("&apos;", stdout);
+			break;
+		case '\t':
+		case '\n':
+		case '\r':
+			putchar(*s);
+			break;
+		default:
+			putchar((u_char)*s < 0x20 ? '?' : *s);
+			break;
+		}
+	}
+}
+
+static void
+cheritest_convert_junit(const struct cheritest_bj_file *cbfp)
+{
+	struct cheritest_result cr;
+	uint64_t usec;
+	uint32_t i, failures, skipped;
+
+	failures = skipped = 0;
+	usec = 0;
+	for (i = 0; i < cbfp->cbf_nrecords; i++) {
+		cheritest_bj_result(cbfp, i, &cr);
+		if (cr.cr_result != CHERITEST_RESULT_PASS &&
+		    cr.cr_xfail_reason != NULL)
+			skipped++;
+		else if (cr.cr_result != CHERITEST_RESULT_PASS)
+			failures++;
+		usec += cr.cr_usec;
+	}
+	printf("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+	printf("<testsuite name=\"cheritest\" tests=\"%u\" failures=\"%u\" "
+	    "skipped=\"%u\" time=\"%ju.%06ju\">\n", cbfp->cbf_nrecords,
+	    failures, skipped, (uintmax_t)(usec / 1000000),
+	    (uintmax_t)(usec % 1000000));
+	for (i = 0; i < cbfp->cbf_nrecords; i++) {
+		cheritest_bj_result(cbfp, i, &cr);
+		printf("  <testcase classname=\"cheritest\" name=\"");
+		cheritest_xml_print(cr.cr_name);
+		printf("\" time=\"%ju.%06ju\">\n",
+		    (uintmax_t)(cr.cr_usec / 1000000),
+		    (uintmax_t)(cr.cr_usec % 1000000));
+		if (cr.cr_result != CHERITEST_RESULT_PASS &&
+		    cr.cr_xfail_reason != NULL) {
+			printf("    <skipped message=\"");
+			cheritest_xml_print(cr.cr_reason);
+			printf(" (expected failure due to ");
+			cheritest_xml_print(cr.cr_xfail_reason);
+			printf(")\"/>\n");
+		} else if (cr.cr_result != CHERITEST_RESULT_PASS) {
+			printf("    <failure type=\"%s\" message=\"",
+			    cheritest_result_names[cr.cr_result]);
+			cheritest_xml_print(cr.cr_reason);
+			printf("\"/>\n");
+		}
+		if (cr.cr_stdout != NULL) {
+			printf("    <system-out>");
+			cheritest_xml_print(cr.cr_stdout);
+			printf("</system-out>\n");
+		}
+		printf("  </testcase>\n");
+	}
+	printf("</testsuite>\n");
+}
+
+static void
+cheritest_convert_tap(const struct cheritest_bj_file *cbfp)
+{
+	struct cheritest_result cr;
+	char nsop[32];
+	uint32_t i;
+
+	printf("TAP version 13\n");
+	printf("1..%u\n", cbfp->cbf_nrecords);
+	for (i = 0; i < cbfp->cbf_nrecords; i++) {
+		cheritest_bj_result(cbfp, i, &cr);
+		printf("%s %u - %s", cr.cr_result == CHERITEST_RESULT_PASS ?
+		    "ok" : "not ok", i + 1, cr.cr_name);
+		if (cr.cr_xfail_reason != NULL)
+			printf(" # TODO %s", cr.cr_xfail_reason);
+		printf("\n");
+		if (cr.cr_result != CHERITEST_RESULT_PASS)
+			printf("# %s: %s\n",
+			    cheritest_result_names[cr.cr_result],
+			    cr.cr_reason);
+		if (cr.cr_has_bench) {
+			cheritest_bench_format(nsop, sizeof(nsop),
+			    cr.cr_bench.cb_nsec_median,
+			    cr.cr_bench.cb_iterations);
+			printf("# %s ns/op\n", nsop);
+		}
+	}
+}
+
+/*
+ * Print the results in a binary journal (--convert) in the given format:
+ * "xo" for the output cheritest would have printed, as selected by the
+ * libxo options, "junit" or "tap".
+ */
+static void
+cheritest_convert(const char *path, const char *format)
+{
+	struct cheritest_bj_file cbf;
+	struct cheritest_result cr;
+	struct cheritest_rusage total;
+	uint32_t i;
+
+	cheritest_bj_load(path, &cbf);
+	if (strcmp(format, "junit") == 0)
+		cheritest_convert_junit(&cbf);
+	else if (strcmp(format, "tap") == 0)
+		cheritest_convert_tap(&cbf);
+	else if (strcmp(format, "xo") == 0) {
+		bzero(&total, sizeof(total));
+		xo_open_container("testsuite");
+		xo_open_list("test");
+		for (i = 0; i < cbf.cbf_nrecords; i++) {
+			cheritest_bj_result(&cbf, i, &cr);
+			xo_open_instance("test");
+			cheritest_emit_result(&cr);
+			xo_close_instance("test");
+			if (cr.cr_has_rusage)
+				cheritest_rusage_add(&total, &cr.cr_rusage);
+		}
+		xo_close_list("test");
+		cheritest_emit_rusage("rusage-total", &total);
+		xo_close_container("testsuite");
+		xo_finish();
+	} else
+		errx(EX_USAGE, "--format %s: unknown format", format);
+	if (fflush(stdout) != 0)
+		err(EX_IOERR, "stdout");
+	exit(EX_OK);
+}
+
+#ifndef LIST_ONLY
+/*
+ * Hardware performance counters (--pmc), counted in each test process by
+ * hwpmc(4).  Each counter is given as an event, optionally labelled; the
+ * events for L2 cache and TLB misses are CPU-specific, so only those with
+ * a libpmc alias are counted by default (CHERITEST_PMC_DEFAULT).  Each
+ * process that runs tests allocates the counters once, and reports their
+ * increase over each test through the child state.
+ */
+static const char *cheritest_pmc_events[CHERITEST_PMC_MAX];
+static char *cheritest_pmc_labels;
+static u_int cheritest_pmc_count;
+static pmc_id_t cheritest_pmc_ids[CHERITEST_PMC_MAX];
+static pmc_value_t cheritest_pmc_base[CHERITEST_PMC_MAX];
+static pid_t cheritest_pmc_pid;		/* Process that allocated them. */
+
+static void
+cheritest_pmc_parse(const char *spec)
+{
+	char *copy, *event, *label, *labels, *p;
+
+	copy = strdup(spec);
+	labels = calloc(1, strlen(spec) + 1);
+	if (copy == NULL || labels == NULL)
+		err(EX_OSERR, "strdup");
+	cheritest_pmc_count = 0;
+	p = copy;
+	while ((event = strsep(&p, ",")) != NULL) {
+		if (*event == '\0')
+			continue;
+		if (cheritest_pmc_count == CHERITEST_PMC_MAX)
+			errx(EX_USAGE, "--pmc: at most %d counters",
+			    CHERITEST_PMC_MAX);
+		label = strsep(&event, "=");
+		if (event == NULL)
+			event = label;
+		if (*label == '\0' || *event == '\0')
+			errx(EX_USAGE, "--pmc: malformed counter in %s", spec);
+		cheritest_pmc_events[cheritest_pmc_count++] = event;
+		if (*labels != '\0')
+			strcat(labels, ",");
+		strcat(labels, label);
+	}
+	if (cheritest_pmc_count == 0)
+		errx(EX_USAGE, "--pmc: no counters in %s", spec);
+	cheritest_pmc_labels = labels;
+	if (pmc_init() < 0)
+		err(EX_UNAVAILABLE, "pmc_init (is hwpmc(4) loaded?)");
+}
+
+/*
+ * Note the counters' values as a test starts, allocating them if this
+ * process has not yet done so.
+ */
+static void
+cheritest_pmc_start(void)
+{
+	u_int i;
+
+	if (cheritest_pmc_count == 0)
+		return;
+	if (cheritest_pmc_pid != getpid()) {
+		for (i = 0; i < cheritest_pmc_count; i++) {
+			if (pmc_allocate(cheritest_pmc_events[i],
+			    PMC_MODE_TC, 0, PMC_CPU_ANY,
+			    &cheritest_pmc_ids[i]) < 0)
+				err(EX_OSERR, "pmc_allocate(%s)",
+				    cheritest_pmc_events[i]);
+			if (pmc_attach(cheritest_pmc_ids[i], 0) < 0)
+				err(EX_OSERR, "pmc_attach(%s)",
+				    cheritest_pmc_events[i]);
+			if (pmc_start(cheritest_pmc_ids[i]) < 0)
+				err(EX_OSERR, "pmc_start(%s)",
+				    cheritest_pmc_events[i]);
+		}
+		cheritest_pmc_pid = getpid();
+	}
+	ccsp->ccs_pmc_valid = 0;
+	for (i = 0; i < cheritest_pmc_count; i++) {
+		if (pmc_read(cheritest_pmc_ids[i], &cheritest_pmc_base[i]) < 0)
+			err(EX_OSERR, "pmc_read(%s)", cheritest_pmc_events[i]);
+	}
+}
+
+/*
+ * Report the counters' increase over the test.  This may be called from
+ * the signal handler, so failures just leave a counter unreported.
+ */
+static void
+cheritest_pmc_stop(void)
+{
+	pmc_value_t value;
+	u_int i;
+
+	if (cheritest_pmc_count == 0 || cheritest_pmc_pid != getpid())
+		return;
+	for (i = 0; i < cheritest_pmc_count; i++) {
+		if (pmc_read(cheritest_pmc_ids[i], &value) < 0)
+			continue;
+		ccsp->ccs_pmc[i] = value - cheritest_pmc_base[i];
+		ccsp->ccs_pmc_valid |= 1 << i;
+	}
+}
+
+/*
+ * Read the "cycles" counter, if one is being counted, so that benchmarks
+ * can report cycles per operation.  Returns -1 if there is none.
+ */
+int
+cheritest_pmc_cycles(uint64_t *cyclesp)
+{
+	pmc_value_t value;
+	u_int i;
+
+	if (cheritest_pmc_pid != getpid())
+		return (-1);
+	for (i = 0; i < cheritest_pmc_count; i++) {
+		if (strcmp(cheritest_pmc_events[i], "cycles") != 0)
+			continue;
+		if (pmc_read(cheritest_pmc_ids[i], &value) < 0)
+			return (-1);
+		*cyclesp = value;
+		return (0);
+	}
+	return (-1);
+}
+
+/*
+ * Journal of the outcome of each test (--journal), allowing a later run to
+ * resume an interrupted run (--resume), or to re-run just the tests that
+ * failed (--rerun-failed).  The journal is a text file, beginning with a
+ * line identifying the binary, followed by a line "select <test>" for each
+ * test the run was to execute, and a line "result <test> <status>" as each
+ * test is reported.  A journal is only kept if one is named; it is started
+ * afresh unless resuming or re-running, when results are appended to it,
+ * the latest result for a test taking precedence.
+ */
+#define	CHERITEST_JOURNAL_MAGIC		"cheritest-journal 1"
+
+static const char *journal_path;	/* NULL: none. */
+static int journal_resume, journal_rerun_failed;
+static FILE *cheritest_journal;
+static u_char *cheritest_journal_results;	/* Latest result per test. */
+static StringList *cheritest_journal_selected;
+
+static void
+cheritest_journal_load(void)
+{
+	const struct cheri_test *ctp;
+	const char *kind, *name;
+	char *line, *p;
+	size_t linecap;
+	u_int r;
+	FILE *fp;
+
+	if (journal_path == NULL)
+		errx(EX_USAGE, "--resume and --rerun-failed require --journal");
+	cheritest_journal_results = calloc(cheri_tests_len,
+	    sizeof(*cheritest_journal_results));
+	if (cheritest_journal_results == NULL)
+		err(EX_OSERR, "calloc");
+	cheritest_journal_selected = sl_init();
+	fp = fopen(journal_path, "r");
+	if (fp == NULL)
+		err(EX_NOINPUT, "%s", journal_path);
+	line = NULL;
+	linecap = 0;
+	if (getline(&line, &linecap, fp) <= 0 ||
+	    strncmp(line, CHERITEST_JOURNAL_MAGIC " ",
+	    strlen(CHERITEST_JOURNAL_MAGIC " ")) != 0)
+		errx(EX_DATAERR, "%s: not a cheritest journal", journal_path);
+	line[strcspn(line, "\n")] = '\0';
+	if (strcmp(line + strlen(CHERITEST_JOURNAL_MAGIC " "),
+	    getprogname()) != 0)
+		errx(EX_DATAERR, "%s: journal is for %s", journal_path,
+		    line + strlen(CHERITEST_JOURNAL_MAGIC " "));
+	while (getline(&line, &linecap, fp) > 0) {
+		line[strcspn(line, "\n")] = '\0';
+		p = line;
+		kind = strsep(&p, " ");
+		name = strsep(&p, " ");
+		if (name == NULL)
+			continue;
+		if (strcmp(kind, "select") == 0) {
+			name = strdup(name);
+			if (name == NULL)
+				err(EX_OSERR, "strdup");
+			sl_add(cheritest_journal_selected, __DECONST(char *,
+			    name));
+			continue;
+		}
+		if (strcmp(kind, "result") != 0 || p == NULL)
+			continue;
+		ctp = cheritest_find_test(name);
+		if (ctp == NULL)
+			continue;
+		for (r = 0; r < nitems(cheritest_result_names); r++) {
+			if (cheritest_result_names[r] != NULL &&
+			    strcmp(p, cheritest_result_names[r]) == 0)
+				cheritest_journal_results[ctp - cheri_tests] = r;
+		}
+	}
+	free(line);
+	fclose(fp);
+}
+
+/*
+ * Drop tests from the selection according to the journal: those that have
+ * completed, with --resume, or that didn't fail, with --rerun-failed.
+ */
+static void
+cheritest_journal_filter(void)
+{
+	const struct cheri_test *ctp;
+	u_int i, n, r;
+
+	n = 0;
+	for (i = 0; i < cheri_selected_tests_len; i++) {
+		ctp = cheri_selected_tests[i];
+		r = cheritest_journal_results[ctp - cheri_tests];
+		if (journal_resume && (r == CHERITEST_RESULT_PASS ||
+		    r == CHERITEST_RESULT_XFAIL))
+			continue;
+		if (journal_rerun_failed && r != CHERITEST_RESULT_FAIL &&
+		    r != CHERITEST_RESULT_TIMEOUT)
+			continue;
+		cheri_selected_tests[n++] = ctp;
+	}
+	if (journal_resume)
+		fprintf(stderr, "Resuming: skipping %u completed tests\n",
+		    cheri_selected_tests_len - n);
+	cheri_selected_tests_len = n;
+}
+
+/*
+ * Open the journal, starting a new one unless resuming or re-running.  Each
+ * record is flushed immediately, so that it survives the run being
+ * interrupted and is not duplicated by children.
+ */
+static void
+cheritest_journal_open(void)
+{
+	u_int i;
+	int append;
+
+	if (journal_path == NULL)
+		return;
+	append = journal_resume || journal_rerun_failed;
+	cheritest_journal = fopen(journal_path, append ? "a" : "w");
+	if (cheritest_journal == NULL)
+		err(EX_CANTCREAT, "%s", journal_path);
+	if (!append) {
+		fprintf(cheritest_journal, "%s %s\n", CHERITEST_JOURNAL_MAGIC,
+		    getprogname());
+		for (i = 0; i < cheri_selected_tests_len; i++)
+			fprintf(cheritest_journal, "select %s\n",
+			    cheri_selected_tests[i]->ct_name);
+	}
+	if (fflush(cheritest_journal) != 0)
+		err(EX_IOERR, "%s", journal_path);
+}
+
+static void
+cheritest_journal_result(const struct cheri_test *ctp, int result)
+{
+
+	if (cheritest_journal == NULL)
+		return;
+	fprintf(cheritest_journal, "result %s %s\n", ctp->ct_name,
+	    cheritest_result_names[result]);
+	if (fflush(cheritest_journal) != 0)
+		err(EX_IOERR, "%s", journal_path);
+}
+
+/*
+ * Fixtures are created on first use by the process about to run or fork a
+ * test.  The supervisor creates them before forking a test, so that they
+ * are shared with all later tests (suite scope); a batch worker forked
+ * before they existed creates its own, which live as long as the worker
+ * (worker scope).  Tests that need none may be forked by the launcher.
+ */
+static int
+cheritest_ccall_fixture_setup(void)
+{
+
+	cheritest_ccall_setup();
+	return (0);
+}
+
+/* In dependency order. */
+static const struct cheritest_fixture {
+	u_int		 cf_fixture;
+	const char	*cf_name;
+	int		(*cf_setup)(void);
+	void		(*cf_destroy)(void);
+} cheritest_fixture_table[] = {
+	{ CT_FIXTURE_SANDBOX_CLASS, "cheritest_sandbox_class_setup",
+	  cheritest_sandbox_class_setup, cheritest_sandbox_class_destroy },
+	{ CT_FIXTURE_SANDBOX_OBJECT, "cheritest_sandbox_object_setup",
+	  cheritest_sandbox_object_setup, cheritest_sandbox_object_destroy },
+	{ CT_FIXTURE_FD, "cheritest_fd_setup",
+	  cheritest_fd_setup, cheritest_fd_destroy },
+	{ CT_FIXTURE_CCALL, "cheritest_ccall_setup",
+	  cheritest_ccall_fixture_setup, NULL },
+};
+
+static u_int cheritest_fixtures_created;
+
+/* Time taken to set up each fixture created by this process, if any. */
+static uint64_t cheritest_fixture_nsec[nitems(cheritest_fixture_table)];
+
+static u_int
+cheritest_fixtures(const struct cheri_test *ctp)
+{
+	u_int fixtures;
+
+	fixtures = ctp->ct_fixtures;
+	if (fixtures == 0 && (ctp->ct_flags & CT_FLAG_SANDBOX))
+		fixtures = CT_FIXTURE_SANDBOX_OBJECT;
+	if (fixtures & CT_FIXTURE_SANDBOX_OBJECT)
+		fixtures |= CT_FIXTURE_SANDBOX_CLASS;
+	return (fixtures);
+}
+
+static void
+cheritest_fixtures_require(u_int fixtures)
+{
+	const struct cheritest_fixture *cfp;
+	uint64_t start;
+	size_t i;
+
+	for (i = 0; i < nitems(cheritest_fixture_table); i++) {
+		cfp = &cheritest_fixture_table[i];
+		if ((fixtures & cfp->cf_fixture) == 0 ||
+		    (cheritest_fixtures_created & cfp->cf_fixture) != 0)
+			continue;
+		start = cheritest_now_nsec();
+		if (cfp->cf_setup() < 0)
+			err(EX_SOFTWARE, "%s", cfp->cf_name);
+		cheritest_fixture_nsec[i] = cheritest_now_nsec() - start;
+		cheritest_fixtures_created |= cfp->cf_fixture;
+	}
+}
+
+/*
+ * Report the setup time of the fixtures created by the supervisor, which
+ * include the load of the helper class; summarise them on stderr too if
+ * more than one test was run.
+ */
+static void
+cheritest_fixtures_report(void)
+{
+	const struct cheritest_fixture *cfp;
+	size_t i;
+
+	xo_open_list("fixture");
+	for (i = 0; i < nitems(cheritest_fixture_table); i++) {
+		cfp = &cheritest_fixture_table[i];
+		if ((cheritest_fixtures_created & cfp->cf_fixture) == 0)
+			continue;
+		xo_open_instance("fixture");
+		xo_emit("{e:name/%s}{e:setup-ns/%ju}", cfp->cf_name,
+		    (uintmax_t)cheritest_fixture_nsec[i]);
+		xo_close_instance("fixture");
+		if (tests_passed + tests_failed > 1)
+			fprintf(stderr, "SUMMARY: %s took %ju.%06jus\n",
+			    cfp->cf_name,
+			    (uintmax_t)cheritest_fixture_nsec[i] / 1000000000,
+			    (uintmax_t)cheritest_fixture_nsec[i] / 1000 %
+			    1000000);
+	}
+	xo_close_list("fixture");
+}
+
+static void
+cheritest_fixtures_destroy(void)
+{
+	const struct cheritest_fixture *cfp;
+	size_t i;
+
+	for (i = nitems(cheritest_fixture_table); i > 0; i--) {
+		cfp = &cheritest_fixture_table[i - 1];
+		if ((cheritest_fixtures_created & cfp->cf_fixture) != 0 &&
+		    cfp->cf_destroy != NULL)
+			cfp->cf_destroy();
+	}
+	cheritest_fixtures_created = 0;
+}
+
+/* Initial size of the buffer used to capture a test's stdout. */
+#define	TEST_BUFFER_LEN	1024
+
+/*
+ * Objects registered as kevent udata by the supervisor; each begins with
+ * one of these tags so that events can be dispatched to the right handler.
+ */
+#define	CHERITEST_KEV_CHILD	0
+#define	CHERITEST_KEV_WORKER	1
+#define	CHERITEST_KEV_LAUNCHER	2
+#define	CHERITEST_KEV_DRAIN	3
+
+/*
+ * Events are copied out of the slots of running tests as they produce
+ * output, and at least this often while any test is running, so that a
+ * test can report more events than its slot holds without losing any.
+ */
+#define	CHERITEST_DRAIN_MSEC	10
+
+/*
+ * Per-test state held by the parent.  Tests may complete out of order when
+ * more than one is run at a time, so results are copied out of the child's
+ * shared-memory slot when it is reaped, allowing the slot to be reused, and
+ * held here until all earlier tests have been reported.
+ *
+ * The child's stdin is fed, and its stdout drained, incrementally by the
+ * supervisor loop in cheritest_run_tests() so that neither the parent nor
+ * the child can block on a full pipe.
+ *
+ * Tests run in a batch worker have cc_worker set, and cc_pid is that of the
+ * worker.  Tests started by the launcher have a cc_pid of -1 until the
+ * launcher has reported the child's pid.
+ */
+struct cheritest_child {
+	int		 cc_kind;	/* CHERITEST_KEV_CHILD */
+	const struct cheri_test	*cc_ctp;
+	struct cheritest_worker	*cc_worker;
+	pid_t		 cc_pid;
+	int		 cc_launched;	/* cc_pid is the launcher's child. */
+	int		 cc_slot;
+	int		 cc_status;
+	int		 cc_done;
+	int		 cc_timedout;
+	u_int		 cc_timeout;
+	uint64_t	 cc_estimate;	/* Expected duration (us). */
+	uint64_t	 cc_start;	/* cheritest_now_usec() when started. */
+	uint64_t	 cc_usec;	/* Duration. */
+	int		 cc_stdin_fd;
+	size_t		 cc_stdin_off;
+	int		 cc_stdout_fd;
+	char		*cc_stdout;
+	size_t		 cc_stdout_len;
+	size_t		 cc_stdout_size;
+	int		 cc_stdout_errno;
+	char		 cc_reason[TESTRESULT_STR_LEN];	/* Framework failure. */
+	struct cheritest_child_state	cc_state;
+	u_int		 cc_seq;	/* Events read from the slot. */
+	u_int		 cc_lost;	/* Events overwritten unread. */
+	struct cheritest_event	*cc_events;
+	u_int		 cc_nevents;
+	int		 cc_has_rusage;
+	struct cheritest_rusage	cc_rusage;
+};
+
+/*
+ * A persistent worker process that runs tests back to back (-b), avoiding
+ * the cost of a fork() per test.  The parent sends the index of each test
+ * and the shared-memory slot to report through over cw_cmd_fd; the worker
+ * replies over cw_result_fd once the test has completed.  Output from all
+ * tests run by a worker shares one stdout pipe, which is attributed to the
+ * test in flight.
+ *
+ * If a worker dies, the in-flight test is held responsible, and a fresh
+ * worker is started for subsequent tests.
+ */
+struct cheritest_worker {
+	int		 cw_kind;	/* CHERITEST_KEV_WORKER */
+	pid_t		 cw_pid;	/* -1: no worker. */
+	int		 cw_retiring;
+	int		 cw_cmd_fd;
+	int		 cw_result_fd;
+	int		 cw_stdout_fd;
+	struct cheritest_child	*cw_current;
+};
+
+struct cheritest_worker_cmd {
+	u_int		 cwc_test;	/* Index into cheri_tests[]. */
+	int		 cwc_slot;
+};
+
+struct cheritest_worker_result {
+	int		 cwr_status;	/* As if returned by waitpid(). */
+	int		 cwr_retire;	/* Worker will exit; don't reuse. */
+	struct cheritest_rusage	cwr_rusage;	/* Used by the test. */
+};
+
+/*
+ * The launcher is forked before any fixture is created, so that its address
+ * space does not include the sandbox class and objects, and forks tests
+ * that need no fixtures on behalf of the supervisor.  Those fork()s then
+ * don't have to duplicate the libcheri mappings.
+ *
+ * The supervisor sends requests over a SOCK_SEQPACKET socket.  The launcher
+ * replies with the pid of each new child, passing back the supervisor's
+ * ends of its stdin and stdout pipes, and reports the child's exit status
+ * once it has been reaped, as the supervisor can't wait for a process that
+ * is not its own child.  For the same reason, the launcher kills tests that
+ * time out: only it knows whether the pid is still that of an unreaped
+ * test, rather than one since reused by an unrelated process.
+ */
+struct cheritest_launcher {
+	int		 cl_kind;	/* CHERITEST_KEV_LAUNCHER */
+	pid_t		 cl_pid;	/* -1: no launcher. */
+	int		 cl_sock;
+};
+
+#define	CHERITEST_LAUNCH_TEST		0	/* Start a test. */
+#define	CHERITEST_LAUNCH_STARTED	1	/* Reply: test started. */
+#define	CHERITEST_LAUNCH_EXITED		2	/* Test process has exited. */
+#define	CHERITEST_LAUNCH_BENCH		3	/* Time fork() (-F). */
+#define	CHERITEST_LAUNCH_BENCH_DONE	4	/* Reply: fork() timed. */
+#define	CHERITEST_LAUNCH_KILL		5	/* Kill a timed-out test. */
+
+struct cheritest_launcher_msg {
+	int		 clm_type;
+	u_int		 clm_child;	/* Index into cheritest_children[]. */
+	u_int		 clm_test;	/* Index into cheri_tests[]. */
+	int		 clm_slot;
+	pid_t		 clm_pid;
+	int		 clm_status;	/* As if returned by waitpid(). */
+	struct cheritest_rusage	clm_rusage;	/* Of the exited test. */
+	u_int		 clm_count;	/* Benchmark iterations. */
+	uint64_t	 clm_nsec;	/* Benchmark total time. */
+};
+
+/* kqueue used by the supervisor to monitor children and their stdio. */
+static int cheritest_kq = -1;
+
+static struct cheritest_worker *cheritest_workers;
+
+static struct cheritest_launcher cheritest_launcher = {
+	.cl_kind = CHERITEST_KEV_LAUNCHER,
+	.cl_pid = -1,
+	.cl_sock = -1,
+};
+
+/* Tests being run by cheritest_run_tests(), for launcher messages. */
+static struct cheritest_child *cheritest_children;
+static u_int cheritest_nchildren;
+static struct cheritest_child *cheritest_slot_tests[CHERITEST_MAX_JOBS];
+static u_int cheritest_slot_nrunning;	/* Entries in use. */
+static int cheritest_drain_kind = CHERITEST_KEV_DRAIN;
+static struct cheritest_rusage cheritest_rusage_total;
+
+static void	cheritest_collect_test(struct cheritest_child *ccp);
+static void	cheritest_kevent(uintptr_t ident, short filter,
+		    u_short flags, u_int fflags, intptr_t data, void *udata);
+static void	cheritest_reap_test(struct cheritest_child *ccp, int status,
+		    const struct cheritest_rusage *crup);
+static u_int	cheritest_timeout(const struct cheri_test *ctp);
+
+/*
+ * Install the signal handlers under which tests run.  Batch workers do this
+ * before each test, as tests may clear them.
+ */
+static void
+cheritest_child_signals(void)
+{
+	struct sigaction sa;
+
+	sa.sa_sigaction = signal_handler;
+	sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGALRM, &sa, NULL) < 0)
+		err(EX_OSERR, "sigaction(SIGALRM)");
+	if (sigaction(SIGPROT, &sa, NULL) < 0)
+		err(EX_OSERR, "sigaction(SIGPROT)");
+	if (sigaction(SIGSEGV, &sa, NULL) < 0)
+		err(EX_OSERR, "sigaction(SIGSEGV)");
+	if (sigaction(SIGBUS, &sa, NULL) < 0)
+		err(EX_OSERR, "sigaction(SIGBUS");
+	if (sigaction(SIGEMT, &sa, NULL) < 0)
+		err(EX_OSERR, "sigaction(SIGEMT)");
+	if (sigaction(SIGTRAP, &sa, NULL) < 0)
+		err(EX_OSERR, "sigaction(SIGEMT)");
+
+	/* The parent ignores SIGPIPE; tests get the default behaviour. */
+	signal(SIGPIPE, SIG_DFL);
+}
+
+/*
+ * Close the supervisor's ends of batch-worker pipes, other tests' stdio
+ * pipes and the launcher socket inherited by a new child, so that they don't
+ * keep a worker's command pipe, another test's stdin, or the launcher, open.
+ * Tests don't exec, so close-on-exec wouldn't help here.
+ */
+static void
+cheritest_close_supervisor_fds(void)
+{
+	struct cheritest_child *ccp;
+	struct cheritest_worker *cwp;
+	u_int i;
+
+	if (cheritest_launcher.cl_sock != -1)
+		close(cheritest_launcher.cl_sock);
+	for (i = 0; i < cheritest_nchildren; i++) {
+		ccp = &cheritest_children[i];
+		if (ccp->cc_stdin_fd != -1)
+			close(ccp->cc_stdin_fd);
+		if (ccp->cc_stdout_fd != -1)
+			close(ccp->cc_stdout_fd);
+	}
+	if (cheritest_workers == NULL)
+		return;
+	for (i = 0; i < njobs; i++) {
+		cwp = &cheritest_workers[i];
+		if (cwp->cw_pid == -1)
+			continue;
+		if (cwp->cw_cmd_fd != -1)
+			close(cwp->cw_cmd_fd);
+		if (cwp->cw_result_fd != -1)
+			close(cwp->cw_result_fd);
+		if (cwp->cw_stdout_fd != -1)
+			close(cwp->cw_stdout_fd);
+	}
+}
+
+/*
+ * Prepare a test's slot for it.  Only the results and the sequence count
+ * are cleared: stale events beyond the count are never read.  The drain
+ * timer runs only while some slot is in use, and uses ident 0, which no
+ * test's timeout timer (identified by pid) can.
+ */
+static void
+cheritest_slot_reset(struct cheritest_child *ccp)
+{
+	int slot;
+
+	slot = ccp->cc_slot;
+	bzero(&ccsp_slots[slot].cs_state, sizeof(ccsp_slots[slot].cs_state));
+	atomic_store_rel_int(&ccsp_slots[slot].cs_seq, 0);
+	if (cheritest_slot_tests[slot] == NULL &&
+	    cheritest_slot_nrunning++ == 0)
+		cheritest_kevent(0, EVFILT_TIMER, EV_ADD, 0,
+		    CHERITEST_DRAIN_MSEC, &cheritest_drain_kind);
+	cheritest_slot_tests[slot] = ccp;
+}
+
+/*
+ * Release a test's slot once its events have been read.
+ */
+static void
+cheritest_slot_release(struct cheritest_child *ccp)
+{
+
+	if (cheritest_slot_tests[ccp->cc_slot] == NULL)
+		return;
+	cheritest_slot_tests[ccp->cc_slot] = NULL;
+	if (--cheritest_slot_nrunning == 0)
+		cheritest_kevent(0, EVFILT_TIMER, EV_DELETE, 0, 0, NULL);
+}
+
+/*
+ * Copy out the events that a test has appended to its slot since last
+ * called.  This may be done while the test is running: an event that is
+ * overwritten while being copied is counted as lost, like those that were
+ * overwritten before they could be read.
+ */
+static void
+cheritest_slot_read_events(struct cheritest_child *ccp)
+{
+	struct cheritest_slot *csp;
+	struct cheritest_event *cep;
+	u_int seq;
+
+	csp = &ccsp_slots[ccp->cc_slot];
+	seq = atomic_load_acq_int(&csp->cs_seq);
+	if (seq == ccp->cc_seq)
+		return;
+	if (seq - ccp->cc_seq > CHERITEST_EVENTS) {
+		ccp->cc_lost += seq - ccp->cc_seq - CHERITEST_EVENTS;
+		ccp->cc_seq = seq - CHERITEST_EVENTS;
+	}
+	ccp->cc_events = reallocarray(ccp->cc_events,
+	    ccp->cc_nevents + (seq - ccp->cc_seq), sizeof(*ccp->cc_events));
+	if (ccp->cc_events == NULL)
+		err(EX_OSERR, "reallocarray");
+	for (; ccp->cc_seq != seq; ccp->cc_seq++) {
+		cep = &csp->cs_events[ccp->cc_seq % CHERITEST_EVENTS];
+		if (atomic_load_acq_int(&cep->ce_seq) != ccp->cc_seq + 1) {
+			ccp->cc_lost++;
+			continue;
+		}
+		memcpy(&ccp->cc_events[ccp->cc_nevents], cep, sizeof(*cep));
+		atomic_thread_fence_acq();
+		if (cep->ce_seq != ccp->cc_seq + 1) {
+			ccp->cc_lost++;
+			continue;
+		}
+		ccp->cc_events[ccp->cc_nevents].ce_str[
+		    CHERITEST_EVENT_STR_LEN - 1] = '\0';
+		ccp->cc_nevents++;
+	}
+}
+
+/*
+ * Copy out the events of every running test, before their slots' rings
+ * wrap.
+ */
+static void
+cheritest_slot_drain(void)
+{
+	u_int slot;
+
+	for (slot = 0; slot < njobs; slot++) {
+		if (cheritest_slot_tests[slot] != NULL)
+			cheritest_slot_read_events(cheritest_slot_tests[slot]);
+	}
+}
+
+static void
+cheritest_child_run(const struct cheri_test *ctp, int slot,
+    int pipefd_stdin[2], int pipefd_stdout[2])
+{
+
+	/* Report via this child's own slot in the shared area. */
+	ccsp = &ccsp_slots[slot].cs_state;
+
+	/* Install signal handlers. */
+	cheritest_child_signals();
+
+	/*
+	 * Set up synthetic stdin and stdout.
+	 */
+	if (dup2(pipefd_stdin[0], STDIN_FILENO) < 0)
+		err(EX_OSERR, "dup2(STDIN_FILENO)");
+	if (dup2(pipefd_stdout[1], STDOUT_FILENO) < 0)
+		err(EX_OSERR, "dup2(STDOUT_FILENO)");
+	close(pipefd_stdin[0]);
+	close(pipefd_stdin[1]);
+	close(pipefd_stdout[0]);
+	close(pipefd_stdout[1]);
+	cheritest_close_supervisor_fds();
+
+	if (qtrace)
+		set_thread_tracing();
+
+	/* Counters are read as the test exits, unless it is killed. */
+	cheritest_pmc_start();
+	if (cheritest_pmc_count != 0 && atexit(cheritest_pmc_stop) != 0)
+		err(EX_OSERR, "atexit");
+
+	/* Run the actual test. */
+	if (ctp->ct_bench != NULL)
+		cheritest_bench(ctp);
+	else if (ctp->ct_arg != 0)
+		ctp->ct_func_arg(ctp, ctp->ct_arg);
+	else
+		ctp->ct_func(ctp);
+	exit(0);
+}
+
+static void
+cheritest_kevent(uintptr_t ident, short filter, u_short flags, u_int fflags,
+    intptr_t data, void *udata)
+{
+	struct kevent kev;
+
+	EV_SET(&kev, ident, filter, flags, fflags, data, udata);
+	if (kevent(cheritest_kq, &kev, 1, NULL, 0, NULL) < 0)
+		err(EX_OSERR, "kevent");
+}
+
+static void
+cheritest_alloc_stdout(struct cheritest_child *ccp)
+{
+
+	ccp->cc_stdout_size = TEST_BUFFER_LEN;
+	ccp->cc_stdout = malloc(ccp->cc_stdout_size);
+	if (ccp->cc_stdout == NULL)
+		err(EX_OSERR, "malloc");
+}
+
+/* Arm a watchdog to kill the test if it overruns its deadline. */
+static void
+cheritest_arm_timeout(struct cheritest_child *ccp)
+{
+
+	ccp->cc_timeout = cheritest_timeout(ccp->cc_ctp);
+	if (ccp->cc_timeout != 0)
+		cheritest_kevent(ccp->cc_pid, EVFILT_TIMER,
+		    EV_ADD | EV_ONESHOT, NOTE_SECONDS, ccp->cc_timeout, ccp);
+}
+
+/*
+ * Disarm the watchdog; it may already have fired, unprocessed, in the same
+ * batch of events.
+ */
+static void
+cheritest_disarm_timeout(struct cheritest_child *ccp)
+{
+	struct kevent kev;
+
+	if (ccp->cc_timeout == 0 || ccp->cc_timedout)
+		return;
+	EV_SET(&kev, ccp->cc_pid, EVFILT_TIMER, EV_DELETE, 0, 0, NULL);
+	if (kevent(cheritest_kq, &kev, 1, NULL, 0, NULL) < 0 &&
+	    errno != ENOENT)
+		err(EX_OSERR, "kevent(EVFILT_TIMER)");
+}
+
+/*
+ * Register the supervisor's ends of a test's stdin and stdout pipes with the
+ * supervisor kqueue.
+ */
+static void
+cheritest_attach_stdio(struct cheritest_child *ccp, int stdin_fd,
+    int stdout_fd)
+{
+
+	if (fcntl(stdout_fd, F_SETFL, O_NONBLOCK) < 0)
+		err(EX_OSERR, "fcntl(F_SETFL, O_NONBLOCK) on test stdout");
+	ccp->cc_stdout_fd = stdout_fd;
+	cheritest_kevent(ccp->cc_stdout_fd, EVFILT_READ, EV_ADD, 0, 0, ccp);
+
+	/* If stdin is to be filled, fill it as the child consumes it. */
+	if (ccp->cc_ctp->ct_flags & CT_FLAG_STDIN_STRING) {
+		if (fcntl(stdin_fd, F_SETFL, O_NONBLOCK) < 0)
+			err(EX_OSERR,
+			    "fcntl(F_SETFL, O_NONBLOCK) on test stdin");
+		ccp->cc_stdin_fd = stdin_fd;
+		cheritest_kevent(ccp->cc_stdin_fd, EVFILT_WRITE, EV_ADD, 0, 0,
+		    ccp);
+	} else {
+		close(stdin_fd);
+		ccp->cc_stdin_fd = -1;
+	}
+}
+
+/*
+ * Start a test in a new child process reporting via shared-memory slot
+ * 'slot', and register its process and stdio with the supervisor kqueue.
+ */
+static void
+cheritest_start_test(struct cheritest_child *ccp, int slot)
+{
+	const struct cheri_test *ctp;
+	struct kevent kev;
+	int pipefd_stdin[2], pipefd_stdout[2];
+
+	ctp = ccp->cc_ctp;
+	ccp->cc_slot = slot;
+	ccp->cc_start = cheritest_now_usec();
+	cheritest_slot_reset(ccp);
+
+	if (pipe(pipefd_stdin) < 0)
+		err(EX_OSERR, "pipe");
+	if (pipe(pipefd_stdout) < 0)
+		err(EX_OSERR, "pipe");
+
+	/*
+	 * Flush stdout and stderr before forking so that we don't risk seeing
+	 * the output again in the child process, which could confuse the test
+	 * framework.
+	 */
+	fflush(stdout);
+	fflush(stderr);
+
+	/*
+	 * Create a child process with suitable signal handling and stdio set
+	 * up; execute the test case.
+	 */
+	ccp->cc_pid = fork();
+	if (ccp->cc_pid < 0)
+		err(EX_OSERR, "fork");
+	if (ccp->cc_pid == 0)
+		cheritest_child_run(ctp, slot, pipefd_stdin, pipefd_stdout);
+	close(pipefd_stdin[0]);
+	close(pipefd_stdout[1]);
+	cheritest_alloc_stdout(ccp);
+	cheritest_attach_stdio(ccp, pipefd_stdin[1], pipefd_stdout[0]);
+	cheritest_arm_timeout(ccp);
+
+	/*
+	 * If the child has already exited, registration fails and it must
+	 * be collected immediately.
+	 */
+	EV_SET(&kev, ccp->cc_pid, EVFILT_PROC, EV_ADD | EV_ONESHOT,
+	    NOTE_EXIT, 0, ccp);
+	if (kevent(cheritest_kq, &kev, 1, NULL, 0, NULL) < 0) {
+		if (errno != ESRCH)
+			err(EX_OSERR, "kevent(EVFILT_PROC)");
+		cheritest_collect_test(ccp);
+	}
+}
+
+/*
+ * Timeout for a test: the command-line override if given, otherwise the
+ * test's own, otherwise a default based on whether it is expected to be
+ * slow.  Benchmarks run for as many calibrated batches as they take, so
+ * they get the slow default.  Zero means no timeout.
+ */
+static u_int
+cheritest_timeout(const struct cheri_test *ctp)
+{
+
+	if (timeout_override >= 0)
+		return (timeout_override);
+	if (ctp->ct_timeout != 0)
+		return (ctp->ct_timeout);
+	if (ctp->ct_flags & (CT_FLAG_SLOW | CT_FLAG_BENCH))
+		return (CHERITEST_TIMEOUT_SLOW);
+	return (CHERITEST_TIMEOUT_DEFAULT);
+}
+
+static void
+cheritest_close_stdin(struct cheritest_child *ccp)
+{
+
+	if (ccp->cc_stdin_fd == -1)
+		return;
+	close(ccp->cc_stdin_fd);
+	ccp->cc_stdin_fd = -1;
+}
+
+/*
+ * Feed as much of the test's stdin string to the child as the pipe will
+ * accept.  A child that exits, or closes stdin, without reading all of its
+ * input is not an error.
+ */
+static void
+cheritest_feed_stdin(struct cheritest_child *ccp)
+{
+	const char *str;
+	size_t resid;
+	ssize_t len;
+
+	str = ccp->cc_ctp->ct_stdin_string;
+	resid = strlen(str) - ccp->cc_stdin_off;
+	while (resid > 0) {
+		len = write(ccp->cc_stdin_fd, str + ccp->cc_stdin_off, resid);
+		if (len < 0) {
+			if (errno == EAGAIN)
+				return;
+			if (errno != EPIPE)
+				snprintf(ccp->cc_reason, sizeof(ccp->cc_reason),
+				    "write() on test stdin failed with -1 (%d)",
+				    errno);
+			break;
+		}
+		ccp->cc_stdin_off += len;
+		resid -= len;
+	}
+	cheritest_close_stdin(ccp);
+}
+
+/*
+ * Append whatever output is available on 'fd' to the test's capture buffer,
+ * growing it as required.  Returns 1 if more output may follow, or 0 on
+ * end-of-file or error.
+ */
+static int
+cheritest_read_stdout(struct cheritest_child *ccp, int fd)
+{
+	ssize_t len;
+
+	for (;;) {
+		/* Always leave room for a terminating nul. */
+		if (ccp->cc_stdout_size - ccp->cc_stdout_len < 2) {
+			ccp->cc_stdout_size *= 2;
+			ccp->cc_stdout = realloc(ccp->cc_stdout,
+			    ccp->cc_stdout_size);
+			if (ccp->cc_stdout == NULL)
+				err(EX_OSERR, "realloc");
+		}
+		len = read(fd, ccp->cc_stdout + ccp->cc_stdout_len,
+		    ccp->cc_stdout_size - ccp->cc_stdout_len - 1);
+		if (len < 0) {
+			if (errno == EAGAIN)
+				return (1);
+			if (errno == EINTR)
+				continue;
+			ccp->cc_stdout_errno = errno;
+			return (0);
+		}
+		if (len == 0)
+			return (0);
+		ccp->cc_stdout_len += len;
+	}
+}
+
+/*
+ * Read whatever output the child has produced so far.  Returns 0 once
+ * end-of-file has been reached.
+ */
+static int
+cheritest_drain_stdout(struct cheritest_child *ccp)
+{
+
+	if (ccp->cc_stdout_fd == -1)
+		return (0);
+	if (cheritest_read_stdout(ccp, ccp->cc_stdout_fd))
+		return (1);
+	close(ccp->cc_stdout_fd);
+	ccp->cc_stdout_fd = -1;
+	return (0);
+}
+
+/*
+ * Mark a test as complete once its process has terminated or its worker
+ * has reported, copying out its state from shared memory.
+ */
+static void
+cheritest_finish_test(struct cheritest_child *ccp)
+{
+
+	ccp->cc_usec = cheritest_now_usec() - ccp->cc_start;
+	memcpy(&ccp->cc_state, &ccsp_slots[ccp->cc_slot].cs_state,
+	    sizeof(ccp->cc_state));
+	cheritest_slot_read_events(ccp);
+	cheritest_slot_release(ccp);
+	ccp->cc_stdout[ccp->cc_stdout_len] = '\0';
+	ccp->cc_done = 1;
+}
+
+/*
+ * Convert resource usage from getrusage() or wait4(), less that in
+ * 'before' if not NULL.
+ */
+static void
+cheritest_rusage_convert(struct cheritest_rusage *crup,
+    const struct rusage *rup, const struct rusage *before)
+{
+	struct rusage zero;
+
+	if (before == NULL) {
+		bzero(&zero, sizeof(zero));
+		before = &zero;
+	}
+	crup->cru_utime_usec =
+	    (rup->ru_utime.tv_sec - before->ru_utime.tv_sec) * 1000000 +
+	    rup->ru_utime.tv_usec - before->ru_utime.tv_usec;
+	crup->cru_stime_usec =
+	    (rup->ru_stime.tv_sec - before->ru_stime.tv_sec) * 1000000 +
+	    rup->ru_stime.tv_usec - before->ru_stime.tv_usec;
+	crup->cru_maxrss_kb = rup->ru_maxrss;
+	crup->cru_minflt = rup->ru_minflt - before->ru_minflt;
+	crup->cru_majflt = rup->ru_majflt - before->ru_majflt;
+	crup->cru_nvcsw = rup->ru_nvcsw - before->ru_nvcsw;
+	crup->cru_nivcsw = rup->ru_nivcsw - before->ru_nivcsw;
+	crup->cru_inblock = rup->ru_inblock - before->ru_inblock;
+	crup->cru_oublock = rup->ru_oublock - before->ru_oublock;
+}
+
+/*
+ * Collect the results of a test whose child process has terminated: its
+ * exit status, signal and result state from shared memory, and any output
+ * remaining in the pipe.
+ */
+static void
+cheritest_collect_test(struct cheritest_child *ccp)
+{
+	struct cheritest_rusage cru;
+	struct rusage ru;
+	int status;
+
+	if (wait4(ccp->cc_pid, &status, 0, &ru) < 0)
+		err(EX_OSERR, "wait4");
+	cheritest_rusage_convert(&cru, &ru, NULL);
+	cheritest_reap_test(ccp, status, &cru);
+}
+
+/*
+ * As cheritest_collect_test(), for a test whose process has already been
+ * reaped with exit status 'status' and resource usage 'crup'.
+ */
+static void
+cheritest_reap_test(struct cheritest_child *ccp, int status,
+    const struct cheritest_rusage *crup)
+{
+
+	cheritest_disarm_timeout(ccp);
+	ccp->cc_status = status;
+	ccp->cc_has_rusage = 1;
+	ccp->cc_rusage = *crup;
+
+	/*
+	 * Anything written by the child is now in the pipe; any writer still
+	 * holding it open (e.g., a grandchild) is not waited for.
+	 */
+	(void)cheritest_drain_stdout(ccp);
+	if (ccp->cc_stdout_fd != -1) {
+		close(ccp->cc_stdout_fd);
+		ccp->cc_stdout_fd = -1;
+	}
+	cheritest_close_stdin(ccp);
+	cheritest_finish_test(ccp);
+}
+
+/*
+ * Tests can share a batch worker unless they expect to be terminated by a
+ * signal, need input on stdin, or leave behind process state that would
+ * affect later tests.
+ */
+static int
+cheritest_batchable(const struct cheri_test *ctp)
+{
+
+	if (!batch)
+		return (0);
+	return ((ctp->ct_flags & (CT_FLAG_SIGNAL | CT_FLAG_SIGNAL_UNWIND |
+	    CT_FLAG_STDIN_STRING | CT_FLAG_NO_BATCH)) == 0);
+}
+
+static void __dead2
+cheritest_worker_main(int cmd_fd, int result_fd)
+{
+	struct cheritest_worker_cmd cwc;
+	struct cheritest_worker_result cwr;
+	struct rusage after, before;
+	u_int numframes;
+	ssize_t len;
+
+	for (;;) {
+		len = read(cmd_fd, &cwc, sizeof(cwc));
+		if (len == 0)
+			_exit(0);
+		if (len != sizeof(cwc))
+			err(EX_OSERR, "read() on worker command pipe");
+		ccsp = &ccsp_slots[cwc.cwc_slot].cs_state;
+		cheritest_fixtures_require(
+		    cheritest_fixtures(&cheri_tests[cwc.cwc_test]));
+		cheritest_child_signals();
+		if (getrusage(RUSAGE_SELF, &before) < 0)
+			err(EX_OSERR, "getrusage");
+		cheritest_pmc_start();
+		cwr.cwr_status = W_EXITCODE(
+		    cheritest_run_inprocess(&cheri_tests[cwc.cwc_test]), 0);
+		cheritest_pmc_stop();
+		alarm(0);
+		fflush(stdout);
+		if (getrusage(RUSAGE_SELF, &after) < 0)
+			err(EX_OSERR, "getrusage");
+		cheritest_rusage_convert(&cwr.cwr_rusage, &after, &before);
+
+		/*
+		 * A failed test unwinds straight back to us, skipping any
+		 * cleanup, and may leak file descriptors, memory, or sandbox
+		 * objects; one that finished with sandboxed code still on the
+		 * trusted stack, e.g., by failing in a callback, is worse.
+		 * Either leaves the worker unfit to run further tests.
+		 */
+		cwr.cwr_retire = cwr.cwr_status != 0 ||
+		    cheri_stack_numframes(&numframes) < 0 || numframes != 0;
+
+		/* Hand the next test a clean default object. */
+		if (!cwr.cwr_retire &&
+		    (cheritest_fixtures(&cheri_tests[cwc.cwc_test]) &
+		    CT_FIXTURE_SANDBOX_OBJECT) != 0 &&
+		    cheritest_sandbox_object_reset() < 0)
+			cwr.cwr_retire = 1;
+		if (write(result_fd, &cwr, sizeof(cwr)) != sizeof(cwr))
+			err(EX_OSERR, "write() on worker result pipe");
+		if (cwr.cwr_retire)
+			_exit(0);
+	}
+}
+
+static void
+cheritest_worker_start(struct cheritest_worker *cwp)
+{
+	int devnull, pipefd_cmd[2], pipefd_result[2], pipefd_stdout[2];
+
+	if (pipe(pipefd_cmd) < 0)
+		err(EX_OSERR, "pipe");
+	if (pipe(pipefd_result) < 0)
+		err(EX_OSERR, "pipe");
+	if (pipe(pipefd_stdout) < 0)
+		err(EX_OSERR, "pipe");
+
+	fflush(stdout);
+	fflush(stderr);
+	cwp->cw_pid = fork();
+	if (cwp->cw_pid < 0)
+		err(EX_OSERR, "fork");
+	if (cwp->cw_pid == 0) {
+		/* Batched tests don't take input. */
+		devnull = open("/dev/null", O_RDONLY);
+		if (devnull < 0)
+			err(EX_OSFILE, "open: /dev/null");
+		if (dup2(devnull, STDIN_FILENO) < 0)
+			err(EX_OSERR, "dup2(STDIN_FILENO)");
+		if (dup2(pipefd_stdout[1], STDOUT_FILENO) < 0)
+			err(EX_OSERR, "dup2(STDOUT_FILENO)");
+		close(devnull);
+		close(pipefd_stdout[0]);
+		close(pipefd_stdout[1]);
+		close(pipefd_cmd[1]);
+		close(pipefd_result[0]);
+		cwp->cw_pid = -1;	/* Don't close our own fds. */
+		cheritest_close_supervisor_fds();
+		if (qtrace)
+			set_thread_tracing();
+		cheritest_worker_main(pipefd_cmd[0], pipefd_result[1]);
+	}
+	close(pipefd_cmd[0]);
+	close(pipefd_result[1]);
+	close(pipefd_stdout[1]);
+	if (fcntl(pipefd_stdout[0], F_SETFL, O_NONBLOCK) < 0)
+		err(EX_OSERR, "fcntl(F_SETFL, O_NONBLOCK) on worker stdout");
+	cwp->cw_kind = CHERITEST_KEV_WORKER;
+	cwp->cw_retiring = 0;
+	cwp->cw_cmd_fd = pipefd_cmd[1];
+	cwp->cw_result_fd = pipefd_result[0];
+	cwp->cw_stdout_fd = pipefd_stdout[0];
+	cwp->cw_current = NULL;
+	cheritest_kevent(cwp->cw_result_fd, EVFILT_READ, EV_ADD, 0, 0, cwp);
+	cheritest_kevent(cwp->cw_stdout_fd, EVFILT_READ, EV_ADD, 0, 0, cwp);
+	cheritest_kevent(cwp->cw_pid, EVFILT_PROC, EV_ADD | EV_ONESHOT,
+	    NOTE_EXIT, 0, cwp);
+}
+
+/*
+ * Find an idle worker, starting a new one if required.  Returns NULL if
+ * all workers are busy or have yet to be reaped.
+ */
+static struct cheritest_worker *
+cheritest_worker_get(void)
+{
+	struct cheritest_worker *cwp, *freep;
+	u_int i;
+
+	freep = NULL;
+	for (i = 0; i < njobs; i++) {
+		cwp = &cheritest_workers[i];
+		if (cwp->cw_pid == -1) {
+			if (freep == NULL)
+				freep = cwp;
+			continue;
+		}
+		if (cwp->cw_current == NULL && !cwp->cw_retiring)
+			return (cwp);
+	}
+	if (freep != NULL)
+		cheritest_worker_start(freep);
+	return (freep);
+}
+
+/*
+ * Hand a test to a worker, reporting through shared-memory slot 'slot'.
+ */
+static void
+cheritest_worker_dispatch(struct cheritest_worker *cwp,
+    struct cheritest_child *ccp, int slot)
+{
+	struct cheritest_worker_cmd cwc;
+
+	ccp->cc_slot = slot;
+	ccp->cc_start = cheritest_now_usec();
+	ccp->cc_worker = cwp;
+	ccp->cc_pid = cwp->cw_pid;
+	ccp->cc_stdin_fd = ccp->cc_stdout_fd = -1;
+	cheritest_alloc_stdout(ccp);
+	cheritest_slot_reset(ccp);
+
+	cwc.cwc_test = ccp->cc_ctp - cheri_tests;
+	cwc.cwc_slot = slot;
+	if (write(cwp->cw_cmd_fd, &cwc, sizeof(cwc)) != sizeof(cwc))
+		err(EX_OSERR, "write() on worker command pipe");
+	cwp->cw_current = ccp;
+	cheritest_arm_timeout(ccp);
+}
+
+/*
+ * Stop sending work to a worker; it exits once its command pipe closes.
+ */
+static void
+cheritest_worker_retire(struct cheritest_worker *cwp)
+{
+
+	cwp->cw_retiring = 1;
+	if (cwp->cw_cmd_fd != -1) {
+		close(cwp->cw_cmd_fd);
+		cwp->cw_cmd_fd = -1;
+	}
+}
+
+/*
+ * The worker's in-flight test has completed, whether reported by the
+ * worker or by its death; attribute output and status to it.
+ */
+static struct cheritest_child *
+cheritest_worker_complete(struct cheritest_worker *cwp, int status,
+    const struct cheritest_rusage *crup)
+{
+	struct cheritest_child *ccp;
+
+	ccp = cwp->cw_current;
+	cwp->cw_current = NULL;
+	cheritest_disarm_timeout(ccp);
+	if (cwp->cw_stdout_fd != -1)
+		(void)cheritest_read_stdout(ccp, cwp->cw_stdout_fd);
+	ccp->cc_status = status;
+	if (crup != NULL) {
+		ccp->cc_has_rusage = 1;
+		ccp->cc_rusage = *crup;
+	}
+	cheritest_finish_test(ccp);
+	return (ccp);
+}
+
+/*
+ * Process an event for a worker.  Returns the test that has completed, if
+ * any.
+ */
+static struct cheritest_child *
+cheritest_worker_event(struct cheritest_worker *cwp,
+    const struct kevent *kevp)
+{
+	struct cheritest_worker_result cwr;
+	const struct cheritest_rusage *crup;
+	struct cheritest_child *ccp;
+	char discard[TEST_BUFFER_LEN];
+	ssize_t len;
+	int status;
+
+	switch (kevp->filter) {
+	case EVFILT_READ:
+		if ((int)kevp->ident == cwp->cw_stdout_fd) {
+			if (cwp->cw_current != NULL) {
+				cheritest_slot_read_events(cwp->cw_current);
+				if (cheritest_read_stdout(cwp->cw_current,
+				    cwp->cw_stdout_fd))
+					return (NULL);
+			} else {
+				/* Output between tests is discarded. */
+				len = read(cwp->cw_stdout_fd, discard,
+				    sizeof(discard));
+				if (len != 0)
+					return (NULL);
+			}
+			close(cwp->cw_stdout_fd);
+			cwp->cw_stdout_fd = -1;
+			return (NULL);
+		}
+		if ((int)kevp->ident != cwp->cw_result_fd)
+			return (NULL);
+		len = read(cwp->cw_result_fd, &cwr, sizeof(cwr));
+		if (len <= 0) {
+			/* The worker has gone; wait for EVFILT_PROC. */
+			close(cwp->cw_result_fd);
+			cwp->cw_result_fd = -1;
+			return (NULL);
+		}
+		if (len != sizeof(cwr))
+			errx(EX_SOFTWARE, "short read on worker result pipe");
+		if (cwr.cwr_retire)
+			cheritest_worker_retire(cwp);
+		if (cwp->cw_current == NULL)
+			return (NULL);
+		return (cheritest_worker_complete(cwp, cwr.cwr_status,
+		    &cwr.cwr_rusage));
+
+	case EVFILT_PROC:
+		if (waitpid(cwp->cw_pid, &status, 0) < 0)
+			err(EX_OSERR, "waitpid");
+
+		/*
+		 * A worker retiring after its last test exits normally, but
+		 * its result may not yet have been read.
+		 */
+		crup = NULL;
+		if (cwp->cw_current != NULL && cwp->cw_result_fd != -1 &&
+		    read(cwp->cw_result_fd, &cwr, sizeof(cwr)) ==
+		    sizeof(cwr)) {
+			status = cwr.cwr_status;
+			crup = &cwr.cwr_rusage;
+		}
+		ccp = NULL;
+		if (cwp->cw_current != NULL)
+			ccp = cheritest_worker_complete(cwp, status, crup);
+		cheritest_worker_retire(cwp);
+		if (cwp->cw_result_fd != -1)
+			close(cwp->cw_result_fd);
+		if (cwp->cw_stdout_fd != -1)
+			close(cwp->cw_stdout_fd);
+		cwp->cw_result_fd = cwp->cw_stdout_fd = -1;
+		cwp->cw_pid = -1;
+		return (ccp);
+
+	default:
+		errx(EX_SOFTWARE, "%s: unexpected filter %d", __func__,
+		    kevp->filter);
+	}
+}
+
+/*
+ * Send a message over the launcher socket, along with 'nfds' file
+ * descriptors from 'fds'.
+ */
+static void
+cheritest_launcher_send(int sock, const struct cheritest_launcher_msg *clmp,
+    const int *fds, int nfds)
+{
+	char cbuf[CMSG_SPACE(2 * sizeof(int))];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+
+	iov.iov_base = __DECONST(void *, clmp);
+	iov.iov_len = sizeof(*clmp);
+	bzero(&msg, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (nfds > 0) {
+		assert(nfds <= 2);
+		bzero(cbuf, sizeof(cbuf));
+		msg.msg_control = cbuf;
+		msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+	}
+	if (sendmsg(sock, &msg, 0) != sizeof(*clmp))
+		err(EX_OSERR, "sendmsg() on launcher socket");
+}
+
+/*
+ * Receive a message from the launcher socket.  Up to two file descriptors
+ * passed with it are returned in 'fds'; unused entries are set to -1.
+ * Returns 0 if the other end has closed the socket.
+ */
+static int
+cheritest_launcher_recv(int sock, struct cheritest_launcher_msg *clmp,
+    int fds[2])
+{
+	char cbuf[CMSG_SPACE(2 * sizeof(int))];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t len;
+	size_t nfds;
+
+	iov.iov_base = clmp;
+	iov.iov_len = sizeof(*clmp);
+	bzero(&msg, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	len = recvmsg(sock, &msg, 0);
+	if (len < 0)
+		err(EX_OSERR, "recvmsg() on launcher socket");
+	if (len == 0)
+		return (0);
+	if (len != sizeof(*clmp) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+		errx(EX_SOFTWARE, "malformed message on launcher socket");
+	fds[0] = fds[1] = -1;
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+	    cmsg->cmsg_type == SCM_RIGHTS) {
+		nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		memcpy(fds, CMSG_DATA(cmsg), MIN(nfds, 2) * sizeof(int));
+	}
+	return (1);
+}
+
+/*
+ * Return the total time, in nanoseconds, taken by this process to fork()
+ * and reap 'count' children that exit immediately.
+ */
+static uint64_t
+cheritest_fork_latency(u_int count)
+{
+	struct timespec start, end;
+	pid_t pid;
+	u_int i;
+	int status;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &start) < 0)
+		err(EX_OSERR, "clock_gettime");
+	for (i = 0; i < count; i++) {
+		pid = fork();
+		if (pid < 0)
+			err(EX_OSERR, "fork");
+		if (pid == 0)
+			_exit(0);
+		if (waitpid(pid, &status, 0) < 0)
+			err(EX_OSERR, "waitpid");
+	}
+	if (clock_gettime(CLOCK_MONOTONIC, &end) < 0)
+		err(EX_OSERR, "clock_gettime");
+	return ((uint64_t)(end.tv_sec - start.tv_sec) * 1000000000 +
+	    end.tv_nsec - start.tv_nsec);
+}
+
+/*
+ * In the launcher, start a test on behalf of the supervisor.  The STARTED
+ * reply is recorded in 'launched' so that the test's exit can be reported
+ * once the child has been reaped.
+ */
+static void
+cheritest_launcher_spawn(int sock, struct cheritest_launcher_msg *clmp,
+    struct cheritest_launcher_msg *launched)
+{
+	int fds[2], pipefd_stdin[2], pipefd_stdout[2];
+	pid_t pid;
+
+	if (clmp->clm_test >= cheri_tests_len || clmp->clm_slot < 0 ||
+	    (u_int)clmp->clm_slot >= njobs)
+		errx(EX_SOFTWARE, "launcher: invalid request");
+	if (pipe(pipefd_stdin) < 0)
+		err(EX_OSERR, "pipe");
+	if (pipe(pipefd_stdout) < 0)
+		err(EX_OSERR, "pipe");
+	pid = fork();
+	if (pid < 0)
+		err(EX_OSERR, "fork");
+	if (pid == 0)
+		cheritest_child_run(&cheri_tests[clmp->clm_test],
+		    clmp->clm_slot, pipefd_stdin, pipefd_stdout);
+	close(pipefd_stdin[0]);
+	close(pipefd_stdout[1]);
+
+	clmp->clm_type = CHERITEST_LAUNCH_STARTED;
+	clmp->clm_pid = pid;
+	launched[clmp->clm_slot] = *clmp;
+	fds[0] = pipefd_stdin[1];
+	fds[1] = pipefd_stdout[0];
+	cheritest_launcher_send(sock, clmp, fds, 2);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+/*
+ * In the launcher, kill a test that has timed out, provided that it is
+ * still running, or at least has not yet been reaped.  Its exit is reported
+ * as usual by cheritest_launcher_reap().
+ */
+static void
+cheritest_launcher_kill(struct cheritest_launcher_msg *clmp,
+    struct cheritest_launcher_msg *launched)
+{
+	struct cheritest_launcher_msg *testp;
+
+	if (clmp->clm_slot < 0 || (u_int)clmp->clm_slot >= njobs)
+		errx(EX_SOFTWARE, "launcher: invalid request");
+	testp = &launched[clmp->clm_slot];
+	if (testp->clm_type != CHERITEST_LAUNCH_STARTED ||
+	    testp->clm_pid != clmp->clm_pid)
+		return;
+	if (kill(testp->clm_pid, SIGKILL) < 0 && errno != ESRCH)
+		err(EX_OSERR, "kill");
+}
+
+/*
+ * In the launcher, reap any tests that have exited and report them to the
+ * supervisor.
+ */
+static void
+cheritest_launcher_reap(int sock, struct cheritest_launcher_msg *launched)
+{
+	struct cheritest_launcher_msg *clmp;
+	struct rusage ru;
+	pid_t pid;
+	u_int slot;
+	int status;
+
+	while ((pid = wait4(WAIT_ANY, &status, WNOHANG, &ru)) > 0) {
+		for (slot = 0; slot < njobs; slot++) {
+			clmp = &launched[slot];
+			if (clmp->clm_type == CHERITEST_LAUNCH_STARTED &&
+			    clmp->clm_pid == pid)
+				break;
+		}
+		if (slot == njobs)
+			continue;
+		clmp->clm_type = CHERITEST_LAUNCH_EXITED;
+		clmp->clm_status = status;
+		cheritest_rusage_convert(&clmp->clm_rusage, &ru, NULL);
+		cheritest_launcher_send(sock, clmp, NULL, 0);
+	}
+	if (pid < 0 && errno != ECHILD)
+		err(EX_OSERR, "wait4");
+}
+
+static void __dead2
+cheritest_launcher_main(int sock)
+{
+	struct cheritest_launcher_msg clm, *launched;
+	struct kevent kev;
+	int fds[2], kq;
+
+	launched = calloc(njobs, sizeof(*launched));
+	if (launched == NULL)
+		err(EX_OSERR, "calloc");
+	kq = kqueue();
+	if (kq < 0)
+		err(EX_OSERR, "kqueue");
+	EV_SET(&kev, sock, EVFILT_READ, EV_ADD, 0, 0, NULL);
+	if (kevent(kq, &kev, 1, NULL, 0, NULL) < 0)
+		err(EX_OSERR, "kevent(EVFILT_READ)");
+	EV_SET(&kev, SIGCHLD, EVFILT_SIGNAL, EV_ADD, 0, 0, NULL);
+	if (kevent(kq, &kev, 1, NULL, 0, NULL) < 0)
+		err(EX_OSERR, "kevent(EVFILT_SIGNAL)");
+
+	for (;;) {
+		if (kevent(kq, NULL, 0, &kev, 1, NULL) < 0) {
+			if (errno == EINTR)
+				continue;
+			err(EX_OSERR, "kevent");
+		}
+		if (kev.filter == EVFILT_SIGNAL) {
+			cheritest_launcher_reap(sock, launched);
+			continue;
+		}
+
+		/* The supervisor closes the socket once all tests are done. */
+		if (!cheritest_launcher_recv(sock, &clm, fds))
+			_exit(0);
+		if (fds[0] != -1)
+			close(fds[0]);
+		if (fds[1] != -1)
+			close(fds[1]);
+		switch (clm.clm_type) {
+		case CHERITEST_LAUNCH_TEST:
+			cheritest_launcher_spawn(sock, &clm, launched);
+			break;
+
+		case CHERITEST_LAUNCH_BENCH:
+			clm.clm_type = CHERITEST_LAUNCH_BENCH_DONE;
+			clm.clm_nsec = cheritest_fork_latency(clm.clm_count);
+			cheritest_launcher_send(sock, &clm, NULL, 0);
+			break;
+
+		case CHERITEST_LAUNCH_KILL:
+			cheritest_launcher_kill(&clm, launched);
+			break;
+
+		default:
+			errx(EX_SOFTWARE, "launcher: unexpected request %d",
+			    clm.clm_type);
+		}
+	}
+}
+
+/*
+ * Fork the launcher.  This must be done before any fixture is created, but
+ * after the shared-memory slots have been allocated.
+ */
+static void
+cheritest_launcher_start(void)
+{
+	int sv[2];
+
+	if (socketpair(PF_LOCAL, SOCK_SEQPACKET, 0, sv) < 0)
+		err(EX_OSERR, "socketpair");
+	fflush(stdout);
+	fflush(stderr);
+	cheritest_launcher.cl_pid = fork();
+	if (cheritest_launcher.cl_pid < 0)
+		err(EX_OSERR, "fork");
+	if (cheritest_launcher.cl_pid == 0) {
+		close(sv[0]);
+		cheritest_launcher.cl_sock = sv[1];
+		cheritest_launcher_main(sv[1]);
+	}
+	close(sv[1]);
+	cheritest_launcher.cl_sock = sv[0];
+}
+
+static void
+cheritest_launcher_stop(void)
+{
+	int status;
+
+	if (cheritest_launcher.cl_pid == -1)
+		return;
+	close(cheritest_launcher.cl_sock);
+	cheritest_launcher.cl_sock = -1;
+	if (waitpid(cheritest_launcher.cl_pid, &status, 0) < 0)
+		err(EX_OSERR, "waitpid");
+	cheritest_launcher.cl_pid = -1;
+}
+
+/*
+ * Ask the launcher to start a test reporting via shared-memory slot 'slot'.
+ * The test's process and stdio are registered with the supervisor kqueue
+ * once the launcher has replied.
+ */
+static void
+cheritest_launch_test(struct cheritest_child *ccp, int slot)
+{
+	struct cheritest_launcher_msg clm;
+
+	ccp->cc_slot = slot;
+	ccp->cc_start = cheritest_now_usec();
+	ccp->cc_pid = -1;
+	ccp->cc_launched = 1;
+	ccp->cc_stdin_fd = ccp->cc_stdout_fd = -1;
+	cheritest_alloc_stdout(ccp);
+	cheritest_slot_reset(ccp);
+
+	bzero(&clm, sizeof(clm));
+	clm.clm_type = CHERITEST_LAUNCH_TEST;
+	clm.clm_child = ccp - cheritest_children;
+	clm.clm_test = ccp->cc_ctp - cheri_tests;
+	clm.clm_slot = slot;
+	cheritest_launcher_send(cheritest_launcher.cl_sock, &clm, NULL, 0);
+}
+
+/*
+ * Ask the launcher to kill a test that it started and that has timed out.
+ */
+static void
+cheritest_launcher_kill_test(struct cheritest_child *ccp)
+{
+	struct cheritest_launcher_msg clm;
+
+	bzero(&clm, sizeof(clm));
+	clm.clm_type = CHERITEST_LAUNCH_KILL;
+	clm.clm_child = ccp - cheritest_children;
+	clm.clm_slot = ccp->cc_slot;
+	clm.clm_pid = ccp->cc_pid;
+	cheritest_launcher_send(cheritest_launcher.cl_sock, &clm, NULL, 0);
+}
+
+/*
+ * Process a message from the launcher.  Returns the test that has
+ * completed, if any.
+ */
+static struct cheritest_child *
+cheritest_launcher_event(void)
+{
+	struct cheritest_launcher_msg clm;
+	struct cheritest_child *ccp;
+	int fds[2];
+
+	if (!cheritest_launcher_recv(cheritest_launcher.cl_sock, &clm, fds))
+		errx(EX_SOFTWARE, "launcher exited unexpectedly");
+	ccp = &cheritest_children[clm.clm_child];
+	switch (clm.clm_type) {
+	case CHERITEST_LAUNCH_STARTED:
+		if (fds[0] == -1 || fds[1] == -1)
+			errx(EX_SOFTWARE, "launcher did not pass test stdio");
+		ccp->cc_pid = clm.clm_pid;
+		cheritest_attach_stdio(ccp, fds[0], fds[1]);
+		cheritest_arm_timeout(ccp);
+		return (NULL);
+
+	case CHERITEST_LAUNCH_EXITED:
+		cheritest_reap_test(ccp, clm.clm_status, &clm.clm_rusage);
+		return (ccp);
+
+	default:
+		errx(EX_SOFTWARE, "%s: unexpected message %d", __func__,
+		    clm.clm_type);
+	}
+}
+
+/*
+ * Benchmark mode (-P): report the mean latency of obtaining a clean sandbox
+ * object by construction, as test_2sandbox_newdestroy does, and from the
+ * pool, each including the object's destruction or reset after having been
+ * dirtied.
+ */
+static void
+cheritest_pool_benchmark(u_int count)
+{
+	struct sandbox_object *sbop;
+	uint64_t construct_nsec, pool_nsec, start;
+	u_int i, reused;
+
+	start = cheritest_now_nsec();
+	for (i = 0; i < count; i++) {
+		if (sandbox_object_new(cheritest_classp, 2*1024*1024,
+		    &sbop) < 0)
+			err(EX_SOFTWARE, "sandbox_object_new");
+		invoke_set_var_data_cap(sandbox_object_getobject(sbop), i);
+		sandbox_object_destroy(sbop);
+	}
+	construct_nsec = cheritest_now_nsec() - start;
+
+	reused = cheritest_pool_reused;
+	start = cheritest_now_nsec();
+	for (i = 0; i < count; i++) {
+		sbop = cheritest_sandbox_pool_get();
+		if (sbop == NULL)
+			err(EX_SOFTWARE, "cheritest_sandbox_pool_get");
+		invoke_set_var_data_cap(sandbox_object_getobject(sbop), i);
+		cheritest_sandbox_pool_put(sbop);
+	}
+	pool_nsec = cheritest_now_nsec() - start;
+	reused = cheritest_pool_reused - reused;
+
+	xo_open_container("pool-benchmark");
+	xo_emit("{:objects/%u} objects: {:construct-ns/%ju} ns/object "
+	    "constructed, {:pool-ns/%ju} ns/object from the pool\n", count,
+	    (uintmax_t)(construct_nsec / count),
+	    (uintmax_t)(pool_nsec / count));
+	xo_emit("{:reused/%u} of {d:objects/%u} objects taken from the pool "
+	    "without construction\n", reused, count);
+	xo_close_container("pool-benchmark");
+}
+
+/*
+ * Benchmark mode (-S): for a range of heap sizes, report the mean latency of
+ * replacing a dirtied sandbox object by construction and destruction, by
+ * sandbox_object_reset(), and by restoring a snapshot taken after
+ * construction, which remaps only the pages dirtied.
+ */
+static const size_t cheritest_snapshot_heap_sizes[] = {
+	256*1024, 2*1024*1024, 16*1024*1024, 64*1024*1024,
+};
+
+static void
+cheritest_snapshot_benchmark(u_int count)
+{
+	struct cheritest_snapshot *csp;
+	struct sandbox_object *sbop;
+	uint64_t new_nsec, reset_nsec, restore_nsec, start;
+	ssize_t n, pages;
+	size_t heap;
+	u_int i, s;
+
+	xo_open_container("snapshot-benchmark");
+	xo_open_list("heap");
+	for (s = 0; s < nitems(cheritest_snapshot_heap_sizes); s++) {
+		heap = cheritest_snapshot_heap_sizes[s];
+		start = cheritest_now_nsec();
+		for (i = 0; i < count; i++) {
+			if (sandbox_object_new(cheritest_classp, heap,
+			    &sbop) < 0)
+				err(EX_SOFTWARE, "sandbox_object_new");
+			invoke_set_var_data_cap(sandbox_object_getobject(sbop),
+			    i);
+			sandbox_object_destroy(sbop);
+		}
+		new_nsec = cheritest_now_nsec() - start;
+
+		if (sandbox_object_new(cheritest_classp, heap, &sbop) < 0)
+			err(EX_SOFTWARE, "sandbox_object_new");
+		start = cheritest_now_nsec();
+		for (i = 0; i < count; i++) {
+			invoke_set_var_data_cap(sandbox_object_getobject(sbop),
+			    i);
+			if (sandbox_object_reset(sbop) < 0)
+				err(EX_SOFTWARE, "sandbox_object_reset");
+		}
+		reset_nsec = cheritest_now_nsec() - start;
+
+		if (cheritest_snapshot_new(sbop, &csp) < 0)
+			err(EX_OSERR, "cheritest_snapshot_new");
+		pages = 0;
+		start = cheritest_now_nsec();
+		for (i = 0; i < count; i++) {
+			invoke_set_var_data_cap(sandbox_object_getobject(sbop),
+			    i);
+			n = cheritest_snapshot_restore(csp);
+			if (n < 0)
+				err(EX_OSERR, "cheritest_snapshot_restore");
+			pages += n;
+		}
+		restore_nsec = cheritest_now_nsec() - start;
+		cheritest_snapshot_destroy(csp);
+		sandbox_object_destroy(sbop);
+
+		xo_open_instance("heap");
+		xo_emit("{:heap-size/%zu} byte heap: "
+		    "{:new-destroy-ns/%ju} ns/new+destroy, "
+		    "{:reset-ns/%ju} ns/reset, {:restore-ns/%ju} ns/restore "
+		    "of {:restore-pages/%ju} pages\n", heap,
+		    (uintmax_t)(new_nsec / count),
+		    (uintmax_t)(reset_nsec / count),
+		    (uintmax_t)(restore_nsec / count),
+		    (uintmax_t)(pages / count));
+		xo_close_instance("heap");
+	}
+	xo_close_list("heap");
+	xo_close_container("snapshot-benchmark");
+}
+
+/*
+ * Benchmark mode (-C): report the mean latency of each phase of loading the
+ * helper class and putting it to use: sandbox_class_new(), which reads the
+ * file, parses its ELF headers, maps its code and finds its methods;
+ * constructing its first object, which maps and relocates the object's
+ * data and fills in its capability table; the first invocation of the
+ * object; and destroying both.  libcheri offers no finer division of
+ * sandbox_class_new().  After the first load, the file is read from the
+ * buffer cache, so the mean is that of a warm load.
+ */
+#define	CHERITEST_CLASS_NEW		0
+#define	CHERITEST_CLASS_OBJECT		1
+#define	CHERITEST_CLASS_INVOKE		2
+#define	CHERITEST_CLASS_DESTROY		3
+#define	CHERITEST_CLASS_PHASES		4
+
+static void
+cheritest_class_benchmark(u_int count)
+{
+	struct sandbox_class *sbcp;
+	struct sandbox_object *sbop;
+	uint64_t nsec[CHERITEST_CLASS_PHASES], now, start;
+	u_int i;
+
+	bzero(nsec, sizeof(nsec));
+	for (i = 0; i < count; i++) {
+		start = cheritest_now_nsec();
+		if (sandbox_class_new(CHERITEST_HELPER_PATH,
+		    CHERITEST_HELPER_MAXLEN, &sbcp) < 0)
+			err(EX_SOFTWARE, "sandbox_class_new");
+		now = cheritest_now_nsec();
+		nsec[CHERITEST_CLASS_NEW] += now - start;
+
+		start = now;
+		if (sandbox_object_new(sbcp, 2*1024*1024, &sbop) < 0)
+			err(EX_SOFTWARE, "sandbox_object_new");
+		now = cheritest_now_nsec();
+		nsec[CHERITEST_CLASS_OBJECT] += now - start;
+
+		start = now;
+		invoke_set_var_data_cap(sandbox_object_getobject(sbop), i);
+		now = cheritest_now_nsec();
+		nsec[CHERITEST_CLASS_INVOKE] += now - start;
+
+		start = now;
+		sandbox_object_destroy(sbop);
+		sandbox_class_destroy(sbcp);
+		nsec[CHERITEST_CLASS_DESTROY] += cheritest_now_nsec() - start;
+	}
+
+	xo_open_container("class-benchmark");
+	xo_emit("{:loads/%u} loads: "
+	    "{:class-ns/%ju} ns sandbox_class_new, "
+	    "{:object-ns/%ju} ns first object, "
+	    "{:invoke-ns/%ju} ns first invocation, "
+	    "{:destroy-ns/%ju} ns destroy\n", count,
+	    (uintmax_t)(nsec[CHERITEST_CLASS_NEW] / count),
+	    (uintmax_t)(nsec[CHERITEST_CLASS_OBJECT] / count),
+	    (uintmax_t)(nsec[CHERITEST_CLASS_INVOKE] / count),
+	    (uintmax_t)(nsec[CHERITEST_CLASS_DESTROY] / count));
+	xo_close_container("class-benchmark");
+}
+
+/*
+ * Benchmark mode (-O): for a range of heap sizes, report the mean latency of
+ * sandbox_object_new() and the resident memory per object as the number
+ * live at once grows by powers of ten to 'count', the number at which
+ * construction first fails (typically on exhausting address space or the
+ * map entry limit), and the mean latency of destroying them; then that of
+ * constructing and immediately destroying 'count' objects in each of one
+ * or more threads at once.
+ */
+static const size_t cheritest_capacity_heap_sizes[] = {
+	64*1024, 1024*1024, 16*1024*1024, 256*1024*1024,
+};
+
+#define	CHERITEST_CAPACITY_THREADS	4	/* Most churning at once. */
+
+struct cheritest_churn {
+	pthread_t	cch_thread;
+	size_t		cch_heap;
+	u_int		cch_count;
+	int		cch_error;	/* errno of the failure; 0: none. */
+};
+
+static void *
+cheritest_churn_thread(void *arg)
+{
+	struct cheritest_churn *cchp;
+	struct sandbox_object *sbop;
+	u_int i;
+
+	cchp = arg;
+	for (i = 0; i < cchp->cch_count; i++) {
+		if (sandbox_object_new(cheritest_classp, cchp->cch_heap,
+		    &sbop) < 0) {
+			cchp->cch_error = errno;
+			break;
+		}
+		sandbox_object_destroy(sbop);
+	}
+	return (NULL);
+}
+
+static uint64_t
+cheritest_rss_kb(void)
+{
+	struct kinfo_proc *kp;
+	uint64_t rss;
+
+	kp = kinfo_getproc(getpid());
+	if (kp == NULL)
+		err(EX_OSERR, "kinfo_getproc");
+	rss = (uint64_t)kp->ki_rssize * getpagesize() / 1024;
+	free(kp);
+	return (rss);
+}
+
+static void
+cheritest_capacity_benchmark(u_int count)
+{
+	struct cheritest_churn churn[CHERITEST_CAPACITY_THREADS];
+	struct sandbox_object **objects;
+	uint64_t nsec, rss, rss_base, start;
+	size_t heap;
+	u_int i, live, nthreads, s, target;
+	int error;
+
+	objects = calloc(count, sizeof(*objects));
+	if (objects == NULL)
+		err(EX_OSERR, "calloc");
+	xo_open_container("capacity-benchmark");
+	xo_open_list("heap");
+	for (s = 0; s < nitems(cheritest_capacity_heap_sizes); s++) {
+		heap = cheritest_capacity_heap_sizes[s];
+		xo_open_instance("heap");
+		xo_emit("{:heap-size/%zu} byte heap:\n", heap);
+
+		xo_open_list("live");
+		rss_base = cheritest_rss_kb();
+		live = 0;
+		error = 0;
+		for (target = 1; error == 0 && live < count;
+		    target = MIN((uint64_t)target * 10, count)) {
+			start = cheritest_now_nsec();
+			for (i = live; live < target; live++) {
+				if (sandbox_object_new(cheritest_classp, heap,
+				    &objects[live]) < 0) {
+					error = errno;
+					break;
+				}
+			}
+			if (live == i)
+				break;
+			nsec = cheritest_now_nsec() - start;
+			rss = cheritest_rss_kb();
+			xo_open_instance("live");
+			xo_emit("  {:objects/%u} live: {:new-ns/%ju} ns/new, "
+			    "{:rss-kb-per-object/%ju} KB resident/object\n",
+			    live, (uintmax_t)(nsec / (live - i)),
+			    (uintmax_t)(rss > rss_base ?
+			    (rss - rss_base) / live : 0));
+			xo_close_instance("live");
+		}
+		xo_close_list("live");
+		if (error != 0)
+			xo_emit("  {:limit-objects/%u} live: "
+			    "{:limit-error/%s}\n", live, strerror(error));
+
+		start = cheritest_now_nsec();
+		for (i = 0; i < live; i++)
+			sandbox_object_destroy(objects[i]);
+		nsec = cheritest_now_nsec() - start;
+		if (live != 0)
+			xo_emit("  {:destroy-ns/%ju} ns/destroy\n",
+			    (uintmax_t)(nsec / live));
+
+		xo_open_list("churn");
+		for (nthreads = 1; nthreads <= CHERITEST_CAPACITY_THREADS;
+		    nthreads *= 2) {
+			start = cheritest_now_nsec();
+			for (i = 0; i < nthreads; i++) {
+				churn[i].cch_heap = heap;
+				churn[i].cch_count = count;
+				churn[i].cch_error = 0;
+				error = pthread_create(&churn[i].cch_thread,
+				    NULL, cheritest_churn_thread, &churn[i]);
+				if (error != 0)
+					errc(EX_OSERR, error,
+					    "pthread_create");
+			}
+			for (i = 0; i < nthreads; i++) {
+				error = pthread_join(churn[i].cch_thread,
+				    NULL);
+				if (error != 0)
+					errc(EX_OSERR, error, "pthread_join");
+			}
+			nsec = cheritest_now_nsec() - start;
+			error = 0;
+			for (i = 0; i < nthreads; i++) {
+				if (churn[i].cch_error != 0)
+					error = churn[i].cch_error;
+			}
+			xo_open_instance("churn");
+			if (error != 0)
+				xo_emit("  {:threads/%u} threads: "
+				    "{:churn-error/%s}\n", nthreads,
+				    strerror(error));
+			else
+				xo_emit("  {:threads/%u} threads: "
+				    "{:churn-ns/%ju} ns/new+destroy, "
+				    "{:churn-per-sec/%ju} objects/s\n",
+				    nthreads, (uintmax_t)(nsec /
+				    ((uint64_t)nthreads * count)),
+				    (uintmax_t)((uint64_t)nthreads * count *
+				    1000000000 / MAX(nsec, 1)));
+			xo_close_instance("churn");
+		}
+		xo_close_list("churn");
+		xo_close_instance("heap");
+	}
+	xo_close_list("heap");
+	xo_close_container("capacity-benchmark");
+	free(objects);
+}
+
+/*
+ * Benchmark mode (-F): report the mean latency of fork() in the launcher,
+ * and in this process once sandbox-ready.
+ */
+static void
+cheritest_fork_benchmark(u_int count)
+{
+	struct cheritest_launcher_msg clm;
+	uint64_t nsec;
+	int fds[2];
+
+	xo_open_container("fork-benchmark");
+	xo_open_list("process");
+	if (cheritest_launcher.cl_pid != -1) {
+		bzero(&clm, sizeof(clm));
+		clm.clm_type = CHERITEST_LAUNCH_BENCH;
+		clm.clm_count = count;
+		cheritest_launcher_send(cheritest_launcher.cl_sock, &clm,
+		    NULL, 0);
+		if (!cheritest_launcher_recv(cheritest_launcher.cl_sock, &clm,
+		    fds) || clm.clm_type != CHERITEST_LAUNCH_BENCH_DONE)
+			errx(EX_SOFTWARE, "launcher exited unexpectedly");
+		xo_open_instance("process");
+		xo_emit("{:name/%s}: {:forks/%u} forks, "
+		    "{:mean-ns/%ju} ns/fork\n", "launcher", count,
+		    (uintmax_t)(clm.clm_nsec / count));
+		xo_close_instance("process");
+	}
+	nsec = cheritest_fork_latency(count);
+	xo_open_instance("process");
+	xo_emit("{:name/%s}: {:forks/%u} forks, {:mean-ns/%ju} ns/fork\n",
+	    "supervisor", count, (uintmax_t)(nsec / count));
+	xo_close_instance("process");
+	xo_close_list("process");
+	xo_close_container("fork-benchmark");
+}
+
+/*
+ * Process an event reported by the supervisor kqueue.  Returns the test
+ * that has completed, if any.
+ */
+static struct cheritest_child *
+cheritest_handle_event(const struct kevent *kevp)
+{
+	struct cheritest_child *ccp;
+
+	if (*(int *)kevp->udata == CHERITEST_KEV_WORKER)
+		return (cheritest_worker_event(kevp->udata, kevp));
+	if (*(int *)kevp->udata == CHERITEST_KEV_LAUNCHER)
+		return (cheritest_launcher_event());
+	if (*(int *)kevp->udata == CHERITEST_KEV_DRAIN) {
+		cheritest_slot_drain();
+		return (NULL);
+	}
+	ccp = kevp->udata;
+	if (ccp->cc_done)
+		return (NULL);
+	switch (kevp->filter) {
+	case EVFILT_READ:
+		cheritest_slot_read_events(ccp);
+		if ((int)kevp->ident == ccp->cc_stdout_fd)
+			(void)cheritest_drain_stdout(ccp);
+		return (NULL);
+
+	case EVFILT_WRITE:
+		if ((int)kevp->ident == ccp->cc_stdin_fd)
+			cheritest_feed_stdin(ccp);
+		return (NULL);
+
+	case EVFILT_TIMER:
+		/*
+		 * The test is collected when EVFILT_PROC fires for the child
+		 * or worker, or when the launcher reports that it has exited.
+		 * Only the launcher can safely kill a test it started.
+		 */
+		ccp->cc_timedout = 1;
+		if (ccp->cc_launched)
+			cheritest_launcher_kill_test(ccp);
+		else if (kill(ccp->cc_pid, SIGKILL) < 0 && errno != ESRCH)
+			err(EX_OSERR, "kill");
+		return (NULL);
+
+	case EVFILT_PROC:
+		cheritest_collect_test(ccp);
+		return (ccp);
+
+	default:
+		errx(EX_SOFTWARE, "%s: unexpected filter %d", __func__,
+		    kevp->filter);
+	}
+}
+
+/*
+ * Repeat mode (-r): each selected test is run repeat_count times, in
+ * rounds, and each run is reported as usual.  Once all have completed, the
+ * distribution of each test's wall-clock and CPU time is reported, along
+ * with tests whose outcome varied between runs.
+ */
+struct cheritest_repeat {
+	uint64_t	*crt_wall;	/* Wall-clock time of each run. */
+	uint64_t	*crt_cpu;	/* User plus system time of each run. */
+	u_int		 crt_nruns;
+	u_int		 crt_ncpu;	/* Runs with resource usage. */
+	u_int		 crt_results[CHERITEST_RESULT_TIMEOUT + 1];
+};
+
+static struct cheritest_repeat *cheritest_repeats;
+
+static void
+cheritest_repeat_record(const struct cheri_test *ctp,
+    const struct cheritest_result *crp)
+{
+	struct cheritest_repeat *crtp;
+
+	if (cheritest_repeats == NULL) {
+		cheritest_repeats = calloc(cheri_tests_len,
+		    sizeof(*cheritest_repeats));
+		if (cheritest_repeats == NULL)
+			err(EX_OSERR, "calloc");
+	}
+	crtp = &cheritest_repeats[ctp - cheri_tests];
+	if (crtp->crt_wall == NULL) {
+		crtp->crt_wall = calloc(repeat_count, sizeof(uint64_t));
+		crtp->crt_cpu = calloc(repeat_count, sizeof(uint64_t));
+		if (crtp->crt_wall == NULL || crtp->crt_cpu == NULL)
+			err(EX_OSERR, "calloc");
+	}
+	if (crtp->crt_nruns == repeat_count)
+		return;
+	crtp->crt_wall[crtp->crt_nruns++] = crp->cr_usec;
+	if (crp->cr_has_rusage)
+		crtp->crt_cpu[crtp->crt_ncpu++] =
+		    crp->cr_rusage.cru_utime_usec +
+		    crp->cr_rusage.cru_stime_usec;
+	crtp->crt_results[crp->cr_result]++;
+}
+
+/*
+ * Emit the distribution of 'n' samples as container 'name': minimum,
+ * median, 99th percentile (nearest rank), maximum and mean, and the number
+ * of outliers, those further from the median than three times the scaled
+ * median absolute deviation.  When most samples are identical, the MAD is
+ * zero, so a sample must also differ from the median by more than a small
+ * tolerance to count as an outlier.
+ */
+#define	CHERITEST_OUTLIER_FRACTION	20	/* Tolerance: 5% of median, */
+#define	CHERITEST_OUTLIER_MIN_USEC	10	/* but at least 10us. */
+
+static void
+cheritest_repeat_emit_stats(const char *name, uint64_t *samples, u_int n)
+{
+	uint64_t *dev, mad, median, sum, tolerance;
+	u_int i, outliers;
+
+	if (n == 0)
+		return;
+	qsort(samples, n, sizeof(*samples), cheritest_u64_compare);
+	median = n % 2 == 1 ? samples[n / 2] :
+	    (samples[n / 2 - 1] + samples[n / 2]) / 2;
+	dev = calloc(n, sizeof(*dev));
+	if (dev == NULL)
+		err(EX_OSERR, "calloc");
+	sum = 0;
+	for (i = 0; i < n; i++) {
+		sum += samples[i];
+		dev[i] = samples[i] > median ? samples[i] - median :
+		    median - samples[i];
+	}
+	qsort(dev, n, sizeof(*dev), cheritest_u64_compare);
+	mad = dev[n / 2];
+	tolerance = MAX(median / CHERITEST_OUTLIER_FRACTION,
+	    CHERITEST_OUTLIER_MIN_USEC);
+	outliers = 0;
+	for (i = 0; i < n; i++) {
+		/* 1.4826 * MAD estimates the standard deviation. */
+		if (dev[i] * 10000 > mad * 3 * 14826 && dev[i] > tolerance)
+			outliers++;
+	}
+	free(dev);
+
+	xo_open_container(name);
+	xo_emit("  {d:name/%s}: min {:min-us/%ju}us median {:median-us/%ju}us "
+	    "p99 {:p99-us/%ju}us max {:max-us/%ju}us mean {:mean-us/%ju}us, "
+	    "{:outliers/%u} outlier(s)\n", name, (uintmax_t)samples[0],
+	    (uintmax_t)median,
+	    (uintmax_t)samples[howmany(n * 99, 100) - 1],
+	    (uintmax_t)samples[n - 1], (uintmax_t)(sum / n), outliers);
+	xo_close_container(name);
+}
+
+/*
+ * Replace the selected tests with repeat_count rounds of them.
+ */
+static void
+cheritest_repeat_select(void)
+{
+	const struct cheri_test **tests;
+	u_int i, r;
+
+	tests = calloc(cheri_selected_tests_len, repeat_count *
+	    sizeof(*tests));
+	if (tests == NULL)
+		err(EX_OSERR, "calloc");
+	for (r = 0; r < repeat_count; r++)
+		for (i = 0; i < cheri_selected_tests_len; i++)
+			tests[r * cheri_selected_tests_len + i] =
+			    cheri_selected_tests[i];
+	free(cheri_selected_tests);
+	cheri_selected_tests = tests;
+	cheri_selected_tests_len *= repeat_count;
+}
+
+static void
+cheritest_repeat_report(void)
+{
+	struct cheritest_repeat *crtp;
+	u_int i, nflaky, r;
+
+	if (cheritest_repeats == NULL)
+		return;
+	nflaky = 0;
+	xo_open_list("repeat");
+	for (i = 0; i < cheri_tests_len; i++) {
+		crtp = &cheritest_repeats[i];
+		if (crtp->crt_nruns == 0)
+			continue;
+		xo_open_instance("repeat");
+		xo_emit("REPEAT: {:name/%s}: {:runs/%u} runs",
+		    cheri_tests[i].ct_name, crtp->crt_nruns);
+		for (r = CHERITEST_RESULT_PASS; r <= CHERITEST_RESULT_TIMEOUT;
+		    r++) {
+			if (crtp->crt_results[r] == crtp->crt_nruns)
+				break;
+		}
+		if (r > CHERITEST_RESULT_TIMEOUT) {
+			nflaky++;
+			xo_emit(", {:flaky/%s}", "flaky");
+		}
+		xo_open_list("outcome");
+		for (r = CHERITEST_RESULT_PASS; r <= CHERITEST_RESULT_TIMEOUT;
+		    r++) {
+			if (crtp->crt_results[r] == 0)
+				continue;
+			xo_open_instance("outcome");
+			xo_emit(" {:count/%u} {:result/%s}",
+			    crtp->crt_results[r], cheritest_result_names[r]);
+			xo_close_instance("outcome");
+		}
+		xo_close_list("outcome");
+		xo_emit("\n");
+		cheritest_repeat_emit_stats("wall", crtp->crt_wall,
+		    crtp->crt_nruns);
+		cheritest_repeat_emit_stats("cpu", crtp->crt_cpu,
+		    crtp->crt_ncpu);
+		xo_close_instance("repeat");
+		free(crtp->crt_wall);
+		free(crtp->crt_cpu);
+	}
+	xo_close_list("repeat");
+	free(cheritest_repeats);
+	cheritest_repeats = NULL;
+	if (nflaky > 0)
+		fprintf(stderr, "FLAKY: %u tests had differing outcomes "
+		    "across %u runs\n", nflaky, repeat_count);
+}
+
+/*
+ * Report the events that a test appended to its slot: always in structured
+ * output, and in text output too if 'show' is set.
+ */
+static void
+cheritest_report_events(struct cheritest_child *ccp, int show)
+{
+	struct cheritest_event *cep;
+	u_int i;
+
+	if (ccp->cc_nevents == 0 && ccp->cc_lost == 0)
+		return;
+	xo_open_list("event");
+	for (i = 0; i < ccp->cc_nevents; i++) {
+		cep = &ccp->cc_events[i];
+		xo_open_instance("event");
+		switch (cep->ce_type) {
+		case CHERITEST_EVENT_CHECKPOINT:
+			xo_emit(show ? "  {:type/%s}: {:name/%s}\n" :
+			    "{e:type/%s}{e:name/%s}", "checkpoint",
+			    cep->ce_str);
+			break;
+
+		case CHERITEST_EVENT_SUBCASE:
+			xo_emit(show ?
+			    "  {:type/%s}: {:name/%s}: {:result/%s}\n" :
+			    "{e:type/%s}{e:name/%s}{e:result/%s}", "subcase",
+			    cep->ce_str, cep->ce_value == TESTRESULT_SUCCESS ?
+			    "PASS" : "FAIL");
+			break;
+
+		case CHERITEST_EVENT_SAMPLE:
+			xo_emit(show ?
+			    "  {:type/%s}: {:name/%s}: {:value/%ju}\n" :
+			    "{e:type/%s}{e:name/%s}{e:value/%ju}", "sample",
+			    cep->ce_str, (uintmax_t)cep->ce_value);
+			break;
+
+		default:
+			xo_emit("{e:type/%u}", cep->ce_type);
+			break;
+		}
+		xo_close_instance("event");
+	}
+	xo_close_list("event");
+	if (ccp->cc_lost != 0)
+		xo_emit(show ? "  {:lost-events/%u} events lost\n" :
+		    "{e:lost-events/%u}", ccp->cc_lost);
+}
+
+/*
+ * Writer for the binary result journal (-B).  The file is grown, and
+ * remapped, a heap chunk at a time as strings are added.
+ */
+static const char *bjournal_path;
+static int cheritest_bj_fd = -1;
+static char *cheritest_bj_base;
+static size_t cheritest_bj_size;	/* Mapped. */
+static size_t cheritest_bj_heap_off;
+static uint32_t cheritest_bj_capacity, cheritest_bj_nrecords;
+static uint32_t cheritest_bj_heap_len;
+
+static void
+cheritest_bj_map(size_t size)
+{
+
+	if (ftruncate(cheritest_bj_fd, size) < 0)
+		err(EX_IOERR, "%s: ftruncate", bjournal_path);
+	if (cheritest_bj_base != NULL &&
+	    munmap(cheritest_bj_base, cheritest_bj_size) < 0)
+		err(EX_OSERR, "munmap");
+	cheritest_bj_base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED, cheritest_bj_fd, 0);
+	if (cheritest_bj_base == MAP_FAILED)
+		err(EX_OSERR, "%s: mmap", bjournal_path);
+	cheritest_bj_size = size;
+}
+
+static void
+cheritest_bj_open(void)
+{
+	struct cheritest_bj_header *cbhp;
+
+	if (bjournal_path == NULL)
+		return;
+	cheritest_bj_fd = open(bjournal_path, O_RDWR | O_CREAT | O_TRUNC,
+	    0644);
+	if (cheritest_bj_fd < 0)
+		err(EX_CANTCREAT, "%s", bjournal_path);
+	cheritest_bj_capacity = cheri_selected_tests_len;
+	cheritest_bj_heap_off = sizeof(*cbhp) +
+	    cheritest_bj_capacity * sizeof(struct cheritest_bj_record);
+	cheritest_bj_map(cheritest_bj_heap_off + CHERITEST_BJ_HEAP_CHUNK);
+
+	/* Offset 0 in the heap is reserved for "no string". */
+	cheritest_bj_base[cheritest_bj_heap_off] = '\0';
+	cheritest_bj_heap_len = 1;
+	cbhp = (struct cheritest_bj_header *)cheritest_bj_base;
+	memcpy(cbhp->cbh_magic, CHERITEST_BJ_MAGIC, sizeof(cbhp->cbh_magic));
+	cbhp->cbh_record_size = cheritest_bj_32(
+	    sizeof(struct cheritest_bj_record));
+	cbhp->cbh_capacity = cheritest_bj_32(cheritest_bj_capacity);
+	cbhp->cbh_nrecords = 0;
+	cbhp->cbh_heap_len = cheritest_bj_32(cheritest_bj_heap_len);
+}
+
+/*
+ * Add a string to the heap, returning its offset in journal byte order.
+ */
+static uint32_t
+cheritest_bj_add_string(const char *str)
+{
+	size_t len, end;
+	uint32_t off;
+
+	if (str == NULL)
+		return (0);
+	len = strlen(str) + 1;
+	end = cheritest_bj_heap_off + cheritest_bj_heap_len + len;
+	if (end > UINT32_MAX)
+		errx(EX_SOFTWARE, "%s: string heap full", bjournal_path);
+	if (end > cheritest_bj_size)
+		cheritest_bj_map(roundup(end, CHERITEST_BJ_HEAP_CHUNK));
+	off = cheritest_bj_heap_len;
+	memcpy(cheritest_bj_base + cheritest_bj_heap_off + off, str, len);
+	cheritest_bj_heap_len += len;
+	return (cheritest_bj_32(off));
+}
+
+static void
+cheritest_bj_append(const struct cheritest_child *ccp,
+    const struct cheritest_result *crp)
+{
+	struct cheritest_bj_header *cbhp;
+	struct cheritest_bj_record cbr;
+	uint32_t flags;
+	u_int i;
+
+	if (cheritest_bj_nrecords == cheritest_bj_capacity)
+		errx(EX_SOFTWARE, "%s: more results than tests",
+		    bjournal_path);
+	bzero(&cbr, sizeof(cbr));
+	cbr.cbr_name = cheritest_bj_add_string(crp->cr_name);
+	cbr.cbr_desc = cheritest_bj_add_string(crp->cr_desc);
+	cbr.cbr_reason = cheritest_bj_add_string(crp->cr_reason);
+	cbr.cbr_xfail_reason = cheritest_bj_add_string(crp->cr_xfail_reason);
+	cbr.cbr_stdout = cheritest_bj_add_string(crp->cr_stdout);
+	cbr.cbr_stdout_error = cheritest_bj_add_string(crp->cr_stdout_error);
+	cbr.cbr_expected_stdout =
+	    cheritest_bj_add_string(crp->cr_expected_stdout);
+	cbr.cbr_pmc_labels = cheritest_bj_add_string(crp->cr_pmc_labels);
+	cbr.cbr_pmc_valid = cheritest_bj_32(crp->cr_pmc_valid);
+	for (i = 0; i < CHERITEST_PMC_MAX; i++)
+		cbr.cbr_pmc[i] = cheritest_bj_64(crp->cr_pmc[i]);
+
+	flags = 0;
+	if (crp->cr_timedout)
+		flags |= CHERITEST_BJ_TIMEDOUT;
+	if (crp->cr_stdout_ignored)
+		flags |= CHERITEST_BJ_STDOUT_IGNORED;
+	if (crp->cr_has_rusage) {
+		flags |= CHERITEST_BJ_RUSAGE;
+		cheritest_bj_rusage(&cbr.cbr_rusage, &crp->cr_rusage);
+	}
+	if (crp->cr_has_bench) {
+		flags |= CHERITEST_BJ_BENCH;
+		cheritest_bj_bench(&cbr.cbr_bench, &crp->cr_bench);
+	}
+	cbr.cbr_test = cheritest_bj_32(ccp->cc_ctp - cheri_tests);
+	cbr.cbr_result = cheritest_bj_32(crp->cr_result);
+	cbr.cbr_flags = cheritest_bj_32(flags);
+	cbr.cbr_status = cheritest_bj_32(ccp->cc_status);
+	cbr.cbr_signum = cheritest_bj_32(ccp->cc_state.ccs_signum);
+	cbr.cbr_si_code = cheritest_bj_32(ccp->cc_state.ccs_si_code);
+	cbr.cbr_mips_cause = cheritest_bj_64(ccp->cc_state.ccs_mips_cause);
+	cbr.cbr_cp2_cause = cheritest_bj_64(ccp->cc_state.ccs_cp2_cause);
+	cbr.cbr_usec = cheritest_bj_64(crp->cr_usec);
+
+	/* Write the record before counting it. */
+	cbhp = (struct cheritest_bj_header *)cheritest_bj_base;
+	memcpy((struct cheritest_bj_record *)(cbhp + 1) +
+	    cheritest_bj_nrecords, &cbr, sizeof(cbr));
+	cheritest_bj_nrecords++;
+	cbhp->cbh_heap_len = cheritest_bj_32(cheritest_bj_heap_len);
+	cbhp->cbh_nrecords = cheritest_bj_32(cheritest_bj_nrecords);
+}
+
+static void
+cheritest_bj_close(void)
+{
+
+	if (cheritest_bj_fd < 0)
+		return;
+	if (munmap(cheritest_bj_base, cheritest_bj_size) < 0)
+		err(EX_OSERR, "munmap");
+	if (ftruncate(cheritest_bj_fd, cheritest_bj_heap_off +
+	    cheritest_bj_heap_len) < 0)
+		err(EX_IOERR, "%s: ftruncate", bjournal_path);
+	if (close(cheritest_bj_fd) < 0)
+		err(EX_IOERR, "%s", bjournal_path);
+	cheritest_bj_fd = -1;
+}
+
+/*
+ * Record a test result: in the binary journal if there is one, and
+ * otherwise as structured output.
+ */
+static void
+cheritest_record_result(struct cheritest_child *ccp,
+    const struct cheritest_result *crp)
+{
+
+	if (repeat_count > 1)
+		cheritest_repeat_record(ccp->cc_ctp, crp);
+	if (cheritest_bj_fd >= 0) {
+		cheritest_bj_append(ccp, crp);
+		return;
+	}
+	xo_open_instance("test");
+	cheritest_emit_result(crp);
+	cheritest_report_events(ccp,
+	    crp->cr_result != CHERITEST_RESULT_PASS || verbose);
+	xo_close_instance("test");
+	xo_flush();
+}
+
+/*
+ * Analyse and report the results of a completed test.
+ */
+static void
+cheritest_report_test(struct cheritest_child *ccp)
+{
+	const struct cheri_test *ctp;
+	struct cheritest_child_state *ccs;
+	struct cheritest_result cr;
+	char reason[TESTRESULT_STR_LEN * 2]; /* Potential output, plus some extra */
+	char visreason[sizeof(reason) * 4]; /* Space for vis(3) the string */
+	const char *xfail_reason;
+	char* failure_message;
+	register_t cp2_exccode, mips_exccode;
+	int status;
+	ssize_t len;
+
+	ctp = ccp->cc_ctp;
+	ccs = &ccp->cc_state;
+	status = ccp->cc_status;
+
+	bzero(&cr, sizeof(cr));
+	cr.cr_name = ctp->ct_name;
+	cr.cr_desc = ctp->ct_desc;
+	cr.cr_usec = ccp->cc_usec;
+	if (ccp->cc_has_rusage) {
+		cr.cr_has_rusage = 1;
+		cr.cr_rusage = ccp->cc_rusage;
+		cheritest_rusage_add(&cheritest_rusage_total, &ccp->cc_rusage);
+	}
+	if (cheritest_pmc_count != 0) {
+		cr.cr_pmc_labels = cheritest_pmc_labels;
+		cr.cr_pmc_valid = ccs->ccs_pmc_valid;
+		memcpy(cr.cr_pmc, ccs->ccs_pmc, sizeof(cr.cr_pmc));
+	}
+
+	/* A test killed after timeout says little about its duration. */
+	if (!ccp->cc_timedout)
+		cheritest_history_update(ctp, ccp->cc_usec);
+
+	if (ctp->ct_check_xfail != NULL)
+		xfail_reason = ctp->ct_check_xfail(ctp->ct_name);
+	else
+		xfail_reason = ctp->ct_xfail_reason;
+	cr.cr_xfail_reason = xfail_reason;
+	if (xfail_reason != NULL)
+		expected_failures++;
+
+	if (ccp->cc_timedout) {
+		snprintf(reason, sizeof(reason),
+		    "Killed after timeout of %u seconds", ccp->cc_timeout);
+		cr.cr_timedout = 1;
+		tests_timedout++;
+		goto fail;
+	}
+	if (ccp->cc_reason[0] != '\0') {
+		strlcpy(reason, ccp->cc_reason, sizeof(reason));
+		goto fail;
+	}
+
+	/*
+	 * First, check for errors from the test framework: successful process
+	 * termination, signal disposition/exception codes/etc.
+	 *
+	 * Analyse child's signal state returned via shared memory.
+	 */
+	if (!WIFEXITED(status)) {
+		snprintf(reason, sizeof(reason), "Child exited abnormally");
+		goto fail;
+	}
+	if (WEXITSTATUS(status) != 0 && WEXITSTATUS(status) != EX_SOFTWARE) {
+		snprintf(reason, sizeof(reason), "Child status %d",
+		    WEXITSTATUS(status));
+		goto fail;
+	}
+	if (ccs->ccs_signum < 0) {
+		snprintf(reason, sizeof(reason),
+		    "Child returned negative signal %d", ccs->ccs_signum);
+		goto fail;
+	}
+	if (ctp->ct_flags & (CT_FLAG_SIGNAL | CT_FLAG_SIGNAL_UNWIND) &&
+	    ccs->ccs_signum != ctp->ct_signum) {
+		snprintf(reason, sizeof(reason), "Expected signal %d, got %d",
+		    ctp->ct_signum, ccs->ccs_signum);
+		goto fail;
+	}
+	if ((ctp->ct_flags & CT_FLAG_SI_CODE) &&
+	    ccs->ccs_si_code != ctp->ct_si_code) {
+		snprintf(reason, sizeof(reason), "Expected si_code %d, got %d",
+		    ctp->ct_si_code, ccs->ccs_si_code);
+		goto fail;
+	}
+	if ((ctp->ct_flags & CT_FLAG_SIGNAL_UNWIND) && !ccs->ccs_unwound) {
+		snprintf(reason, sizeof(reason), "Expected trusted stack "
+		   "unwind, but none seen");
+		goto fail;
+	}
+	if (!(ctp->ct_flags & CT_FLAG_SIGNAL_UNWIND) && ccs->ccs_unwound) {
+		snprintf(reason, sizeof(reason), "Unexpected trusted stack "
+		    "unwind");
+		goto fail;
+	}
+	if (ctp->ct_flags & CT_FLAG_MIPS_EXCCODE) {
+		mips_exccode = (ccs->ccs_mips_cause & MIPS_CR_EXC_CODE) >>
+		    MIPS_CR_EXC_CODE_SHIFT;
+		if (mips_exccode != ctp->ct_mips_exccode) {
+			snprintf(reason, sizeof(reason),
+			    "Expected MIPS exccode %ju, got %ju",
+			    ctp->ct_mips_exccode, mips_exccode);
+			goto fail;
+		}
+	}
+	if (ctp->ct_flags & CT_FLAG_CP2_EXCCODE) {
+		cp2_exccode = (ccs->ccs_cp2_cause &
+		    CHERI_CAPCAUSE_EXCCODE_MASK) >>
+		    CHERI_CAPCAUSE_EXCCODE_SHIFT;
+		if (cp2_exccode != ctp->ct_cp2_exccode) {
+			snprintf(reason, sizeof(reason),
+			    "Expected CP2 exccode %ju, got %ju",
+			    ctp->ct_cp2_exccode, cp2_exccode);
+			goto fail;
+		}
+	}
+
+	/*
+	 * Next, see whether any expected output was present.
+	 */
+	len = ccp->cc_stdout_len;
+	if (ccp->cc_stdout_errno != 0)
+		cr.cr_stdout_error = strerror(ccp->cc_stdout_errno);
+	else if (len > 0) {
+		cr.cr_stdout = ccp->cc_stdout;
+		cr.cr_stdout_ignored =
+		    (ctp->ct_flags & CT_FLAG_STDOUT_IGNORE) != 0;
+	}
+	if (ctp->ct_flags & CT_FLAG_STDOUT_STRING) {
+		cr.cr_expected_stdout = ctp->ct_stdout_string;
+		if (ccp->cc_stdout_errno != 0) {
+			snprintf(reason, sizeof(reason),
+			    "read() on test stdout failed with -1 (%d)",
+			    ccp->cc_stdout_errno);
 			goto fail;
 		}
-		buffer[len] = '\0';
-		if (strcmp(buffer, ctp->ct_stdout_string) != 0) {
+		if (strcmp(ccp->cc_stdout, ctp->ct_stdout_string) != 0) {
 			if (verbose)
 				snprintf(reason, sizeof(reason),
 				    "read() on test stdout expected '%s' "
 				    "but got '%s'",
-				    ctp->ct_stdout_string, buffer);
+				    ctp->ct_stdout_string, ccp->cc_stdout);
 			else
 				snprintf(reason, sizeof(reason),
 				    "read() on test stdout did not match");
@@ -1699,7 +5658,7 @@ cheritest_run_test(const struct cheri_test *ctp)
 			if (verbose)
 				snprintf(reason, sizeof(reason),
 				    "read() on test stdout produced "
-				    "unexpected output '%s'", buffer);
+				    "unexpected output '%s'", ccp->cc_stdout);
 			else
 				snprintf(reason, sizeof(reason),
 				    "read() on test stdout produced "
@@ -1716,44 +5675,48 @@ cheritest_run_test(const struct cheri_test *ctp)
 	 * an expected/desired fault don't undergo these checks.
 	 */
 	if (!(ctp->ct_flags & CT_FLAG_SIGNAL)) {
-		if (ccsp->ccs_testresult == TESTRESULT_UNKNOWN) {
+		if (ccs->ccs_testresult == TESTRESULT_UNKNOWN) {
 			snprintf(reason, sizeof(reason),
 			    "Test failed to set a success/failure status");
 			goto fail;
 		}
-		if (ccsp->ccs_testresult == TESTRESULT_FAILURE) {
+		if (ccs->ccs_testresult == TESTRESULT_FAILURE) {
 			/*
 			 * Ensure string is nul-terminated, as we will print
 			 * it in due course, and a failed test might have left
 			 * a corrupted string.
 			 */
-			ccsp->ccs_testresult_str[
-			    sizeof(ccsp->ccs_testresult_str) - 1] = '\0';
-			memcpy(reason, ccsp->ccs_testresult_str,
-			    sizeof(reason));
+			ccs->ccs_testresult_str[
+			    sizeof(ccs->ccs_testresult_str) - 1] = '\0';
+			memcpy(reason, ccs->ccs_testresult_str,
+			    sizeof(ccs->ccs_testresult_str));
 			goto fail;
 		}
-		if (ccsp->ccs_testresult != TESTRESULT_SUCCESS) {
+		if (ccs->ccs_testresult != TESTRESULT_SUCCESS) {
 			snprintf(reason, sizeof(reason),
 			    "Test returned unexpected result (%d)",
-			    ccsp->ccs_testresult);
+			    ccs->ccs_testresult);
 			goto fail;
 		}
 	}
 
-	if (xfail_reason == NULL)
-		xo_emit("{:status/%s}: {d:name/%s}\n", "PASS", ctp->ct_name);
-	else {
-		xo_attr("expected", "false");
-		xo_emit("{:status/%s}: {d:name/%s} (Expected failure due to "
-		    "{d:expected-failure-reason/%s})\n",
-		    "PASS", ctp->ct_name, xfail_reason);
+	if ((ctp->ct_flags & CT_FLAG_BENCH) && ccs->ccs_bench_iterations != 0) {
+		cr.cr_has_bench = 1;
+		cr.cr_bench.cb_iterations = ccs->ccs_bench_iterations;
+		cr.cr_bench.cb_nsec_min = ccs->ccs_bench_nsec_min;
+		cr.cr_bench.cb_nsec_median = ccs->ccs_bench_nsec_median;
+		cr.cr_bench.cb_nsec_p90 = ccs->ccs_bench_nsec_p90;
+		cr.cr_bench.cb_nsec_max = ccs->ccs_bench_nsec_max;
+		cr.cr_bench.cb_batches = ccs->ccs_bench_batches;
+		cr.cr_bench.cb_cycles_min = ccs->ccs_bench_cycles_min;
+		cr.cr_bench.cb_cycles_median = ccs->ccs_bench_cycles_median;
+		cr.cr_bench.cb_cycles_p90 = ccs->ccs_bench_cycles_p90;
+		cr.cr_bench.cb_cycles_max = ccs->ccs_bench_cycles_max;
 	}
+	cr.cr_result = CHERITEST_RESULT_PASS;
+	cheritest_record_result(ccp, &cr);
+	cheritest_journal_result(ctp, CHERITEST_RESULT_PASS);
 	tests_passed++;
-	close(pipefd_stdin[1]);
-	close(pipefd_stdout[0]);
-	xo_close_instance("test");
-	xo_flush();
 	return;
 
 fail:
@@ -1762,37 +5725,238 @@ fail:
 	 */
 	strnvis(visreason, sizeof(visreason), reason, VIS_TAB);
 	asprintf(&failure_message, "%s: %s", ctp->ct_name, visreason);
-	if (xfail_reason == NULL) {
-		xo_emit("{:status/%s}: {d:name/%s}: {:failure-reason/%s}\n",
-		    "FAIL", ctp->ct_name, visreason);
+	if (xfail_reason == NULL)
 		sl_add(cheri_failed_tests, failure_message);
-	} else {
-		xo_attr("expected", "true");
-		xo_emit("{d:/%s}{:status/%s}: {d:name/%s}: "
-		    "{:failure-reason/%s} ({d:expected-failure-reason/%s})\n",
-		    "X", "FAIL", ctp->ct_name, visreason, xfail_reason);
+	else {
 		tests_xfailed++;
 		sl_add(cheri_xfailed_tests, failure_message);
 	}
+	cr.cr_reason = visreason;
+	if (ccp->cc_timedout)
+		cr.cr_result = CHERITEST_RESULT_TIMEOUT;
+	else if (xfail_reason != NULL)
+		cr.cr_result = CHERITEST_RESULT_XFAIL;
+	else
+		cr.cr_result = CHERITEST_RESULT_FAIL;
+	cheritest_record_result(ccp, &cr);
+	cheritest_journal_result(ctp, cr.cr_result);
 	tests_failed++;
-	xo_close_instance("test");
-	xo_flush();
-	close(pipefd_stdin[1]);
-	close(pipefd_stdout[0]);
 }
 
+/*
+ * Sort tests by decreasing expected duration, so that the longest are
+ * started first, breaking ties by selection order.
+ */
+static int
+cheritest_order_compare(const void *a, const void *b)
+{
+	const struct cheritest_child *cca, *ccb;
+
+	cca = &cheritest_children[*(const u_int *)a];
+	ccb = &cheritest_children[*(const u_int *)b];
+	if (cca->cc_estimate != ccb->cc_estimate)
+		return (cca->cc_estimate > ccb->cc_estimate ? -1 : 1);
+	return (cca < ccb ? -1 : 1);
+}
+
+/*
+ * Show progress, and an estimate of the time remaining assuming that the
+ * remaining work is spread evenly over the jobs, on the terminal.
+ */
 static void
-cheritest_run_test_name(const char *name)
+cheritest_show_eta(const struct cheritest_child *children, u_int ntests,
+    u_int nreported)
 {
-	u_int i;
+	const struct cheritest_child *ccp;
+	uint64_t elapsed, now, remaining;
+	u_int i, secs;
+
+	now = cheritest_now_usec();
+	remaining = 0;
+	for (i = nreported; i < ntests; i++) {
+		ccp = &children[i];
+		if (ccp->cc_done)
+			continue;
+		elapsed = ccp->cc_start != 0 ? now - ccp->cc_start : 0;
+		if (elapsed < ccp->cc_estimate)
+			remaining += ccp->cc_estimate - elapsed;
+	}
+	secs = remaining / njobs / 1000000;
+	fprintf(stderr, "\r[%u/%u] ETA %u:%02u\033[K", nreported, ntests,
+	    secs / 60, secs % 60);
+}
 
-	for (i = 0; i < cheri_tests_len; i++) {
-		if (strcmp(name, cheri_tests[i].ct_name) == 0)
-			break;
+/*
+ * Run the selected tests, with up to 'njobs' child processes executing at
+ * once.  Each running test is allocated its own slot in the shared-memory
+ * area.  When running tests concurrently, those expected to take longest
+ * are started first.  Results are reported strictly in selection order,
+ * regardless of the order in which children complete, so that output is
+ * the same as that of a sequential run.
+ */
+static void
+cheritest_run_tests(const struct cheri_test **tests, u_int ntests)
+{
+	struct kevent events[16];
+	struct cheritest_child *children, *ccp;
+	struct cheritest_worker *cwp;
+	int *free_slots;
+	u_int *order;
+	u_int fixtures, next_start, next_report, nfree, t, w;
+	int eta, i, nevents, status;
+
+	if (ntests == 0)
+		return;
+	children = calloc(ntests, sizeof(*children));
+	if (children == NULL)
+		err(EX_OSERR, "calloc");
+	order = calloc(ntests, sizeof(*order));
+	if (order == NULL)
+		err(EX_OSERR, "calloc");
+	for (t = 0; t < ntests; t++) {
+		children[t].cc_ctp = tests[t];
+		children[t].cc_estimate = cheritest_estimate(tests[t], 1);
+		children[t].cc_stdin_fd = children[t].cc_stdout_fd = -1;
+		order[t] = t;
+	}
+	cheritest_children = children;
+	cheritest_nchildren = ntests;
+	if (njobs > 1)
+		qsort(order, ntests, sizeof(*order), cheritest_order_compare);
+	eta = isatty(STDERR_FILENO);
+	free_slots = calloc(njobs, sizeof(*free_slots));
+	if (free_slots == NULL)
+		err(EX_OSERR, "calloc");
+	for (nfree = 0; nfree < njobs; nfree++)
+		free_slots[nfree] = njobs - nfree - 1;
+	if (batch) {
+		cheritest_workers = calloc(njobs, sizeof(*cheritest_workers));
+		if (cheritest_workers == NULL)
+			err(EX_OSERR, "calloc");
+		for (w = 0; w < njobs; w++)
+			cheritest_workers[w].cw_pid = -1;
+	}
+	cheritest_kq = kqueue();
+	if (cheritest_kq < 0)
+		err(EX_OSERR, "kqueue");
+	if (cheritest_launcher.cl_pid != -1)
+		cheritest_kevent(cheritest_launcher.cl_sock, EVFILT_READ, EV_ADD,
+		    0, 0, &cheritest_launcher);
+
+	next_start = next_report = 0;
+	while (next_report < ntests) {
+		/* Fill any free slots with new tests. */
+		while (nfree > 0 && next_start < ntests) {
+			ccp = &children[order[next_start]];
+			fixtures = cheritest_fixtures(ccp->cc_ctp);
+			if (cheritest_batchable(ccp->cc_ctp)) {
+				/* New workers inherit the fixtures. */
+				cheritest_fixtures_require(fixtures);
+				cwp = cheritest_worker_get();
+				if (cwp == NULL)
+					break;
+				cheritest_worker_dispatch(cwp, ccp,
+				    free_slots[--nfree]);
+			} else if (cheritest_launcher.cl_pid != -1 &&
+			    fixtures == 0) {
+				cheritest_launch_test(ccp, free_slots[--nfree]);
+			} else {
+				cheritest_fixtures_require(fixtures);
+				cheritest_start_test(ccp, free_slots[--nfree]);
+				if (ccp->cc_done)
+					free_slots[nfree++] = ccp->cc_slot;
+			}
+			next_start++;
+		}
+
+		/* Report completed tests in order. */
+		ccp = &children[next_report];
+		if (ccp->cc_done) {
+			if (eta)
+				fprintf(stderr, "\r\033[K");
+			cheritest_report_test(ccp);
+			free(ccp->cc_stdout);
+			free(ccp->cc_events);
+			next_report++;
+			if (eta && next_report < ntests)
+				cheritest_show_eta(children, ntests,
+				    next_report);
+			if (sleep_after_test)
+				sleep(1);
+			continue;
+		}
+
+		/*
+		 * Otherwise, wait for running tests to make progress: stdio,
+		 * process termination, or events to copy out.
+		 */
+		nevents = kevent(cheritest_kq, NULL, 0, events,
+		    nitems(events), NULL);
+		if (nevents < 0) {
+			if (errno == EINTR)
+				continue;
+			err(EX_OSERR, "kevent");
+		}
+		for (i = 0; i < nevents; i++) {
+			if (events[i].flags & EV_ERROR)
+				errc(EX_OSERR, events[i].data, "kevent");
+			ccp = cheritest_handle_event(&events[i]);
+			if (ccp != NULL)
+				free_slots[nfree++] = ccp->cc_slot;
+		}
 	}
-	if (i == cheri_tests_len)
+
+	/* Shut down any remaining workers. */
+	if (batch) {
+		for (w = 0; w < njobs; w++) {
+			cwp = &cheritest_workers[w];
+			if (cwp->cw_pid == -1)
+				continue;
+			cheritest_worker_retire(cwp);
+			if (cwp->cw_result_fd != -1)
+				close(cwp->cw_result_fd);
+			if (cwp->cw_stdout_fd != -1)
+				close(cwp->cw_stdout_fd);
+		}
+		for (w = 0; w < njobs; w++) {
+			cwp = &cheritest_workers[w];
+			if (cwp->cw_pid != -1)
+				(void)waitpid(cwp->cw_pid, &status, 0);
+		}
+		free(cheritest_workers);
+		cheritest_workers = NULL;
+	}
+	close(cheritest_kq);
+	cheritest_kq = -1;
+	cheritest_children = NULL;
+	cheritest_nchildren = 0;
+	free(free_slots);
+	free(order);
+	free(children);
+}
+
+/*
+ * Append a test to the list of those to run, unless excluded by the
+ * command-line filtering options.
+ */
+static void
+cheritest_select_test(const struct cheri_test *ctp)
+{
+
+	if (cheritest_set_isset(&cheritest_excluded, ctp - cheri_tests))
+		return;
+	cheri_selected_tests[cheri_selected_tests_len++] = ctp;
+}
+
+static void
+cheritest_select_test_name(const char *name)
+{
+	const struct cheri_test *ctp;
+
+	ctp = cheritest_find_test(name);
+	if (ctp == NULL)
 		errx(EX_USAGE, "unknown test: %s", name);
-	cheritest_run_test(&cheri_tests[i]);
+	cheritest_select_test(ctp);
 }
 #endif /* !LIST_ONLY */
 
@@ -1802,30 +5966,82 @@ main(int argc, char *argv[])
 	int opt;
 	int glob = 0;
 #ifndef LIST_ONLY
+	const struct cheri_test *ctp;
 	stack_t stack;
 	int i;
-	u_int t;
+	u_int fixtures, t;
 #endif
 	uint qemu_trace_perthread;
 	size_t len;
+#ifndef LIST_ONLY
+	size_t ccsp_len, journal_len;
+	const char *errstr;
+#endif
 
 	argc = xo_parse_args(argc, argv);
 	if (argc < 0)
 		errx(1, "xo_parse_args failed\n");
-	while ((opt = getopt(argc, argv, "afglqsuv")) != -1) {
+	while ((opt = getopt_long(argc, argv, "abB:C:fF:gH:j:lO:P:qr:sS:t:uv",
+	    longopts, NULL)) != -1) {
 		switch (opt) {
 		case 'a':
 			run_all = 1;
 			break;
+#ifndef LIST_ONLY
+		case 'b':
+			batch = 1;
+			break;
+		case 'B':
+			bjournal_path = optarg;
+			break;
+		case 'C':
+			class_benchmark = strtonum(optarg, 1, UINT_MAX,
+			    &errstr);
+			if (errstr != NULL)
+				errx(EX_USAGE, "-C %s: %s", optarg, errstr);
+			break;
+#endif
 		case 'f':
 			fast_tests_only = 1;
 			break;
+#ifndef LIST_ONLY
+		case 'F':
+			fork_benchmark = strtonum(optarg, 1, UINT_MAX, &errstr);
+			if (errstr != NULL)
+				errx(EX_USAGE, "-F %s: %s", optarg, errstr);
+			break;
+#endif
 		case 'g':
 			glob = 1;
 			break;
+		case 'H':
+			history_path = optarg;
+			history_explicit = 1;
+			break;
+#ifndef LIST_ONLY
+		case 'j':
+			njobs = strtonum(optarg, 1, CHERITEST_MAX_JOBS,
+			    &errstr);
+			if (errstr != NULL)
+				errx(EX_USAGE, "-j %s: %s", optarg, errstr);
+			break;
+#endif
 		case 'l':
 			list = 1;
 			break;
+#ifndef LIST_ONLY
+		case 'O':
+			capacity_benchmark = strtonum(optarg, 1, UINT_MAX,
+			    &errstr);
+			if (errstr != NULL)
+				errx(EX_USAGE, "-O %s: %s", optarg, errstr);
+			break;
+		case 'P':
+			pool_benchmark = strtonum(optarg, 1, UINT_MAX, &errstr);
+			if (errstr != NULL)
+				errx(EX_USAGE, "-P %s: %s", optarg, errstr);
+			break;
+#endif
 		case 'q':
 			len = sizeof(qemu_trace_perthread);
 			if (sysctlbyname("hw.qemu_trace_perthread",
@@ -1838,15 +6054,61 @@ main(int argc, char *argv[])
 				    "hw.qemu_trace_perthread=1");
 			qtrace = 1;
 			break;
+#ifndef LIST_ONLY
+		case 'r':
+			repeat_count = strtonum(optarg, 1,
+			    CHERITEST_REPEAT_MAX, &errstr);
+			if (errstr != NULL)
+				errx(EX_USAGE, "-r %s: %s", optarg, errstr);
+			break;
+#endif
 		case 's':
 			sleep_after_test = 1;
 			break;
+#ifndef LIST_ONLY
+		case 'S':
+			snapshot_benchmark = strtonum(optarg, 1, UINT_MAX,
+			    &errstr);
+			if (errstr != NULL)
+				errx(EX_USAGE, "-S %s: %s", optarg, errstr);
+			break;
+		case 't':
+			timeout_override = strtonum(optarg, 0, INT_MAX,
+			    &errstr);
+			if (errstr != NULL)
+				errx(EX_USAGE, "-t %s: %s", optarg, errstr);
+			break;
+#endif
 		case 'u':
 			unsandboxed_tests_only = 1;
 			break;
 		case 'v':
 			verbose++;
 			break;
+		case CHERITEST_OPT_SHARD:
+			cheritest_parse_shard(optarg);
+			break;
+		case CHERITEST_OPT_CONVERT:
+			convert_path = optarg;
+			break;
+		case CHERITEST_OPT_FORMAT:
+			convert_format = optarg;
+			break;
+#ifndef LIST_ONLY
+		case CHERITEST_OPT_JOURNAL:
+			journal_path = optarg[0] != '\0' ? optarg : NULL;
+			break;
+		case CHERITEST_OPT_RESUME:
+			journal_resume = 1;
+			break;
+		case CHERITEST_OPT_RERUN_FAILED:
+			journal_rerun_failed = 1;
+			break;
+		case CHERITEST_OPT_PMC:
+			cheritest_pmc_parse(optarg != NULL ? optarg :
+			    CHERITEST_PMC_DEFAULT);
+			break;
+#endif
 		default:
 			warnx("unknown argument %c\n", opt);
 			usage();
@@ -1862,6 +6124,14 @@ main(int argc, char *argv[])
 		warnx("-a and -g are incompatible");
 		usage();
 	}
+	if (convert_path != NULL) {
+		if (argc > 0 || run_all || list) {
+			warnx("--convert takes no tests");
+			usage();
+		}
+		cheritest_convert(convert_path, convert_format);
+	}
+	cheritest_sets_init();
 	if (list) {
 		if (argc == 0)
 			list_tests();
@@ -1873,7 +6143,14 @@ main(int argc, char *argv[])
 	else
 		usage();
 #else /* LIST_ONLY */
-	if (argc == 0 && !run_all)
+	if (journal_resume && journal_rerun_failed) {
+		warnx("--resume and --rerun-failed are incompatible");
+		usage();
+	}
+	if (argc == 0 && !run_all && capacity_benchmark == 0 &&
+	    class_benchmark == 0 && fork_benchmark == 0 &&
+	    pool_benchmark == 0 && snapshot_benchmark == 0 &&
+	    !journal_resume && !journal_rerun_failed)
 		usage();
 	if (argc > 0 && run_all) {
 		warnx("-a and a list of test are incompatible");
@@ -1901,72 +6178,142 @@ main(int argc, char *argv[])
 		err(EX_OSERR, "sigaltstack");
 
 	/*
-	 * Allocate a page shared with children processes to return success/
-	 * failure status.
+	 * Allocate memory shared with children processes to return success/
+	 * failure status, with one slot for each concurrently running child.
 	 */
-	assert(sizeof(*ccsp) <= (size_t)getpagesize());
-	ccsp = mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_ANON, -1,
-	    0);
-	if (ccsp == MAP_FAILED)
+	ccsp_len = roundup2(njobs * sizeof(*ccsp_slots), getpagesize());
+	ccsp_slots = mmap(NULL, ccsp_len, PROT_READ | PROT_WRITE, MAP_ANON,
+	    -1, 0);
+	if (ccsp_slots == MAP_FAILED)
 		err(EX_OSERR, "mmap");
-	if (minherit(ccsp, getpagesize(), INHERIT_SHARE) < 0)
+	if (minherit(ccsp_slots, ccsp_len, INHERIT_SHARE) < 0)
 		err(EX_OSERR, "minherit");
+	ccsp = &ccsp_slots[0].cs_state;
 
 	cheri_failed_tests = sl_init();
 	cheri_xfailed_tests = sl_init();
-	/* Run the actual tests. */
-#if 0
-	cheritest_ccall_setup();
-#endif
-	if (!unsandboxed_tests_only) {
-		if (cheritest_libcheri_setup() < 0)
-			err(EX_SOFTWARE, "cheritest_libcheri_setup");
+
+	/*
+	 * Select the tests to run; a glob may match the same test more than
+	 * once.  If no tests are given when resuming or re-running, those
+	 * selected for the journalled run are used, as already sharded.
+	 */
+	journal_len = 0;
+	if (journal_resume || journal_rerun_failed) {
+		cheritest_journal_load();
+		journal_len = cheritest_journal_selected->sl_cur;
 	}
-	xo_open_container("testsuite");
-	xo_open_list("test");
+	cheri_selected_tests = calloc((argc + 1) * cheri_tests_len +
+	    journal_len, sizeof(*cheri_selected_tests));
+	if (cheri_selected_tests == NULL)
+		err(EX_OSERR, "calloc");
 	if (run_all) {
+		/* Benchmarks are only run when named or globbed. */
 		for (t = 0; t < cheri_tests_len; t++) {
-			if (fast_tests_only &&
-			    (cheri_tests[t].ct_flags & CT_FLAG_SLOW))
-				continue;
-			if (unsandboxed_tests_only &&
-			    (cheri_tests[t].ct_flags & CT_FLAG_SANDBOX))
+			if (cheritest_set_isset(cheritest_tag_set(
+			    CHERITEST_TAG_BENCH), t))
 				continue;
-			cheritest_run_test(&cheri_tests[t]);
-			if (sleep_after_test)
-				sleep(1);
+			cheritest_select_test(&cheri_tests[t]);
 		}
 	} else if (glob) {
 		for (i = 0; i < argc; i++) {
+			/* A pattern without wildcards can only match itself. */
+			if (strpbrk(argv[i], "*?[\\") == NULL) {
+				ctp = cheritest_find_test(argv[i]);
+				if (ctp != NULL)
+					cheritest_select_test(ctp);
+				continue;
+			}
 			for (t = 0; t < cheri_tests_len; t++) {
+				if (cheritest_set_isset(&cheritest_excluded, t))
+					continue;
 				if (fnmatch(argv[i], cheri_tests[t].ct_name,
 				    0) != 0)
 					continue;
-				if (fast_tests_only &&
-				    (cheri_tests[t].ct_flags & CT_FLAG_SLOW))
-					continue;
-				if (unsandboxed_tests_only &&
-				    (cheri_tests[t].ct_flags & CT_FLAG_SANDBOX))
-					continue;
-				cheritest_run_test(&cheri_tests[t]);
-				if (sleep_after_test)
-					sleep(1);
+				cheritest_select_test(&cheri_tests[t]);
 			}
 		}
+	} else if (argc > 0) {
+		for (i = 0; i < argc; i++)
+			cheritest_select_test_name(argv[i]);
 	} else {
-		for (i = 0; i < argc; i++) {
-			if (fast_tests_only &&
-			    (cheri_tests[i].ct_flags & CT_FLAG_SLOW))
-				continue;
-			if (unsandboxed_tests_only &&
-			    (cheri_tests[i].ct_flags & CT_FLAG_SANDBOX))
-				continue;
-			cheritest_run_test_name(argv[i]);
-		}
+		for (i = 0; (size_t)i < journal_len; i++)
+			cheritest_select_test_name(
+			    cheritest_journal_selected->sl_str[i]);
+	}
+
+	cheritest_history_load();
+	if (shard_count != 0 && (run_all || argc > 0))
+		cheri_selected_tests_len = cheritest_shard(cheri_selected_tests,
+		    cheri_selected_tests_len);
+	if (journal_resume || journal_rerun_failed)
+		cheritest_journal_filter();
+	if (repeat_count > 1)
+		cheritest_repeat_select();
+
+	/*
+	 * Run the actual tests.  Tests that need no fixtures are forked by
+	 * the launcher, which must therefore be started before the first
+	 * fixture is created; it is only worth having if some tests do.
+	 */
+	fixtures = 0;
+	for (i = 0; (size_t)i < cheri_selected_tests_len; i++)
+		fixtures |= cheritest_fixtures(cheri_selected_tests[i]);
+	if (fork_benchmark != 0 && !unsandboxed_tests_only)
+		fixtures = CT_FIXTURE_SANDBOX_CLASS |
+		    CT_FIXTURE_SANDBOX_OBJECT | CT_FIXTURE_FD;
+	if (pool_benchmark != 0)
+		fixtures |= CT_FIXTURE_SANDBOX_CLASS |
+		    CT_FIXTURE_SANDBOX_OBJECT;
+	if (snapshot_benchmark != 0 || capacity_benchmark != 0)
+		fixtures |= CT_FIXTURE_SANDBOX_CLASS;
+	if (fixtures != 0)
+		cheritest_launcher_start();
+
+	/*
+	 * Load the helper class before any batch worker is forked, so that
+	 * they share it rather than each loading its own.
+	 */
+	if (batch && (fixtures & CT_FIXTURE_SANDBOX_CLASS) != 0)
+		cheritest_fixtures_require(CT_FIXTURE_SANDBOX_CLASS);
+
+	/* Test stdin write errors are handled by the supervisor. */
+	signal(SIGPIPE, SIG_IGN);
+	if (fork_benchmark != 0 || pool_benchmark != 0 ||
+	    snapshot_benchmark != 0 || capacity_benchmark != 0 ||
+	    class_benchmark != 0) {
+		cheritest_fixtures_require(fixtures);
+		if (class_benchmark != 0)
+			cheritest_class_benchmark(class_benchmark);
+		if (fork_benchmark != 0)
+			cheritest_fork_benchmark(fork_benchmark);
+		if (pool_benchmark != 0)
+			cheritest_pool_benchmark(pool_benchmark);
+		if (snapshot_benchmark != 0)
+			cheritest_snapshot_benchmark(snapshot_benchmark);
+		if (capacity_benchmark != 0)
+			cheritest_capacity_benchmark(capacity_benchmark);
+		cheritest_launcher_stop();
+		cheritest_fixtures_destroy();
+		xo_finish();
+		exit(EX_OK);
 	}
+	cheritest_journal_open();
+	cheritest_bj_open();
+
+	/* With -B, the results go to the journal, and only summaries here. */
+	xo_open_container("testsuite");
+	xo_open_list("test");
+	cheritest_run_tests(cheri_selected_tests, cheri_selected_tests_len);
+	cheritest_launcher_stop();
+	cheritest_history_save();
 	xo_close_list("test");
+	cheritest_repeat_report();
+	cheritest_emit_rusage("rusage-total", &cheritest_rusage_total);
+	cheritest_fixtures_report();
 	xo_close_container("testsuite");
 	xo_finish();
+	cheritest_bj_close();
 
 	/* print a summary which tests failed */
 	/* XXXAR: use xo_emit? */
@@ -1997,10 +6344,28 @@ main(int argc, char *argv[])
 			    "(%d expected) (%d unexpected passes)\n",
 			    tests_passed, tests_failed, tests_xfailed,
 			    expected_failures - tests_xfailed);
+		fprintf(stderr, "SUMMARY: user %ju.%06jus system %ju.%06jus "
+		    "max RSS %juK\n",
+		    (uintmax_t)cheritest_rusage_total.cru_utime_usec / 1000000,
+		    (uintmax_t)cheritest_rusage_total.cru_utime_usec % 1000000,
+		    (uintmax_t)cheritest_rusage_total.cru_stime_usec / 1000000,
+		    (uintmax_t)cheritest_rusage_total.cru_stime_usec % 1000000,
+		    (uintmax_t)cheritest_rusage_total.cru_maxrss_kb);
+		fprintf(stderr, "SUMMARY: faults %ju minor %ju major, "
+		    "context switches %ju voluntary %ju involuntary, "
+		    "blocks %ju in %ju out\n",
+		    (uintmax_t)cheritest_rusage_total.cru_minflt,
+		    (uintmax_t)cheritest_rusage_total.cru_majflt,
+		    (uintmax_t)cheritest_rusage_total.cru_nvcsw,
+		    (uintmax_t)cheritest_rusage_total.cru_nivcsw,
+		    (uintmax_t)cheritest_rusage_total.cru_inblock,
+		    (uintmax_t)cheritest_rusage_total.cru_oublock);
 	}
+	if (tests_timedout > 0)
+		fprintf(stderr, "TIMEOUT: %d failed tests killed after "
+		    "timeout\n", tests_timedout);
 
-	if (!unsandboxed_tests_only)
-		cheritest_libcheri_destroy();
+	cheritest_fixtures_destroy();
 	if (tests_failed > tests_xfailed)
 		exit(-1);
 	exit(EX_OK);
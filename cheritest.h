@@ -64,6 +64,7 @@
  * Shared memory interface between tests and the test controller process.
  */
 #define	TESTRESULT_STR_LEN	1024
+#define	CHERITEST_PMC_MAX	8	/* Counters per test (--pmc). */
 struct cheritest_child_state {
 	/* Fields filled in by the child signal handler. */
 	int		ccs_signum;
@@ -75,9 +76,63 @@ struct cheritest_child_state {
 	/* Fields filled in by the test itself. */
 	int		ccs_testresult;
 	char		ccs_testresult_str[TESTRESULT_STR_LEN];
+
+	/* Fields filled in by the benchmark framework (CT_FLAG_BENCH). */
+	uint64_t	ccs_bench_iterations;	/* Per batch. */
+	uint64_t	ccs_bench_nsec_min;	/* Fastest batch. */
+	uint64_t	ccs_bench_nsec_median;
+	uint64_t	ccs_bench_nsec_p90;
+	uint64_t	ccs_bench_nsec_max;	/* Slowest batch. */
+	u_int		ccs_bench_batches;
+	uint64_t	ccs_bench_cycles_min;	/* 0: not counted. */
+	uint64_t	ccs_bench_cycles_median;
+	uint64_t	ccs_bench_cycles_p90;
+	uint64_t	ccs_bench_cycles_max;
+
+	/* Counter deltas over the test, filled in by the framework. */
+	uint64_t	ccs_pmc[CHERITEST_PMC_MAX];
+	u_int		ccs_pmc_valid;		/* Bit per counter read. */
 };
 extern struct cheritest_child_state *ccsp;
 
+/*
+ * Events that a test may report before it exits or faults: checkpoints
+ * reached, the results of sub-cases, and timing or other samples.  They
+ * are appended to a ring in the test's slot, which the parent may read at
+ * any time without locking: an event is valid once its ce_seq is one more
+ * than its position in the sequence of events, and the slot's cs_seq is
+ * the number of events appended so far.  Events overwritten before the
+ * parent reads them are counted as lost.
+ */
+#define	CHERITEST_EVENT_CHECKPOINT	1
+#define	CHERITEST_EVENT_SUBCASE		2	/* Value: TESTRESULT_*. */
+#define	CHERITEST_EVENT_SAMPLE		3
+
+#define	CHERITEST_EVENT_STR_LEN		48
+#define	CHERITEST_EVENTS		64	/* Ring size. */
+
+struct cheritest_event {
+	volatile u_int	ce_seq;
+	u_int		ce_type;
+	uint64_t	ce_value;
+	char		ce_str[CHERITEST_EVENT_STR_LEN];
+};
+
+/*
+ * One slot in the shared result area for each concurrently running test,
+ * aligned so that children never share a cache line.  cs_state is first,
+ * so ccsp also locates the slot.
+ */
+#define	CHERITEST_CACHE_LINE_SIZE	64
+
+struct cheritest_slot {
+	struct cheritest_child_state	cs_state;
+	volatile u_int			cs_seq
+	    __aligned(CHERITEST_CACHE_LINE_SIZE);
+	struct cheritest_event		cs_events[CHERITEST_EVENTS]
+	    __aligned(CHERITEST_CACHE_LINE_SIZE);
+} __aligned(CHERITEST_CACHE_LINE_SIZE);
+
 /*
  * If the test runs to completion, it must set ccs_testresult to SUCCESS or
  * FAILURE.  If the latter, it should also fill ccs_testresult_str with a
@@ -106,13 +161,38 @@ extern struct cheritest_child_state *ccsp;
 #define	CT_FLAG_SANDBOX		0x00000100  /* Test requires that a libcheri
 					     * sandbox be created. */
 #define	CT_FLAG_SI_CODE		0x00000200  /* Check signal si_code. */
+#define	CT_FLAG_NO_BATCH	0x00000400  /* Test changes process state;
+					       never share a worker. */
+#define	CT_FLAG_BENCH		0x00000800  /* Benchmark: ct_bench, if set,
+					       is run in timed batches. */
+
+/*
+ * Fixtures that must exist before a test runs: the cheritest-helper class
+ * (cheritest_classp), its default object (cheritest_objectp, which implies
+ * the class), the stdin, stdout, and /dev/zero fd objects, and the sealed
+ * capabilities used by the CCall/CReturn tests.  They are created on first
+ * use, and torn down at exit only if they were created.  A CT_FLAG_SANDBOX
+ * test that declares none gets CT_FIXTURE_SANDBOX_OBJECT.
+ */
+#define	CT_FIXTURE_SANDBOX_CLASS	0x00000001
+#define	CT_FIXTURE_SANDBOX_OBJECT	0x00000002
+#define	CT_FIXTURE_FD			0x00000004
+#define	CT_FIXTURE_CCALL		0x00000008
 
 #define	CHERITEST_SANDBOX_UNWOUND	0x123456789ULL
 
+/*
+ * Default timeouts, in seconds, after which the test controller kills a
+ * test that has not terminated.  Tests may override these via ct_timeout.
+ */
+#define	CHERITEST_TIMEOUT_DEFAULT	60
+#define	CHERITEST_TIMEOUT_SLOW		600
+
 struct cheri_test {
 	const char	*ct_name;
 	const char	*ct_desc;
-	int		 ct_arg;	/* 0: ct_func; otherwise ct_func_arg. */
+	int		 ct_arg;	/* For ct_bench, if set; otherwise
+					   0: ct_func, else ct_func_arg. */
 	void		(*ct_func)(const struct cheri_test *);
 	void		(*ct_func_arg)(const struct cheri_test *, int);
 	const char *	(*ct_check_xfail)(const char *);
@@ -124,6 +204,10 @@ struct cheri_test {
 	const char	*ct_stdin_string;
 	const char	*ct_stdout_string;
 	const char	*ct_xfail_reason;
+	u_int		 ct_timeout;	/* Seconds; 0: default for ct_flags. */
+	u_int		 ct_fixtures;	/* CT_FIXTURE_*; 0: default for
+					   ct_flags. */
+	void		(*ct_bench)(const struct cheri_test *, uint64_t);
 };
 
 /*
@@ -134,8 +218,39 @@ struct cheri_test {
 void	cheritest_failure_err(const char *msg, ...) __dead2  __printflike(1, 2);
 void	cheritest_failure_errx(const char *msg, ...) __dead2  __printflike(1, 2);
 void	cheritest_success(void) __dead2;
+
+/*
+ * Report progress to the test controller without terminating.
+ */
+void	cheritest_checkpoint(const char *label);
+void	cheritest_subcase(const char *name, int result);
+void	cheritest_sample(const char *label, uint64_t value);
 void	signal_handler_clear(int sig);
 
+/*
+ * Run a test without terminating the process, as done by batch workers;
+ * returns the exit status the test would otherwise have terminated with.
+ */
+int	cheritest_run_inprocess(const struct cheri_test *ctp);
+
+/* qsort(3) comparison function for uint64_t. */
+int	cheritest_u64_compare(const void *a, const void *b);
+
+/*
+ * Run a CT_FLAG_BENCH test's kernel in calibrated, timed batches, and
+ * report the timings through the child state.
+ */
+void	cheritest_bench(const struct cheri_test *ctp) __dead2;
+
+/*
+ * Time one call of 'fn' in the same way, for tests that measure several
+ * configurations; returns the median in picoseconds.
+ */
+uint64_t	cheritest_bench_psec(void (*fn)(void *, uint64_t), void *arg);
+
+/* Read the "cycles" counter if counted with --pmc; -1 if it isn't. */
+int	cheritest_pmc_cycles(uint64_t *cyclesp);
+
 #ifdef __CHERI_PURE_CAPABILITY__
 /* cheritest_bounds_globals.c */
 void	test_bounds_global_static_uint8(const struct cheri_test *ctp);
@@ -254,6 +369,12 @@ void	test_fault_ccall_data_unsealed(const struct cheri_test *ctp);
 void	test_fault_ccall_typemismatch(const struct cheri_test *ctp);
 void	test_fault_ccall_code_noexecute(const struct cheri_test *ctp);
 void	test_fault_ccall_data_execute(const struct cheri_test *ctp);
+void	bench_ccall_creturn(const struct cheri_test *ctp,
+	    uint64_t iterations);
+void	bench_ccall_nop_creturn(const struct cheri_test *ctp,
+	    uint64_t iterations);
+void	bench_ccall_dli_creturn(const struct cheri_test *ctp,
+	    uint64_t iterations);
 
 /* cheritest_cheriabi.c */
 void	test_cheriabi_mmap_nospace(const struct cheri_test *ctp);
@@ -295,6 +416,12 @@ void	test_sandbox_vm_wfault_catch(const struct cheri_test *ctp);
 void	test_sandbox_vm_wfault_nocatch(const struct cheri_test *ctp);
 void	test_sandbox_vm_xfault_catch(const struct cheri_test *ctp);
 void	test_sandbox_vm_xfault_nocatch(const struct cheri_test *ctp);
+void	bench_sandbox_cp2_fault(const struct cheri_test *ctp,
+	    uint64_t iterations);
+void	bench_sandbox_divzero(const struct cheri_test *ctp,
+	    uint64_t iterations);
+void	bench_sandbox_vm_fault(const struct cheri_test *ctp,
+	    uint64_t iterations);
 
 /* cheritest_fd.c */
 #define	CHERITEST_FD_READ_STR	"read123"
@@ -305,6 +432,8 @@ extern struct cheri_object	 stdin_fd_object;
 extern struct cheri_object	 stdout_fd_object;
 extern struct cheri_object	 zero_fd_object;
 
+int	cheritest_fd_setup(void);
+void	cheritest_fd_destroy(void);
 void	test_sandbox_fd_fstat(const struct cheri_test *ctp);
 void	test_sandbox_fd_lseek(const struct cheri_test *ctp);
 void	test_sandbox_fd_read(const struct cheri_test *ctp);
@@ -313,8 +442,13 @@ void	test_sandbox_fd_write(const struct cheri_test *ctp);
 void	test_sandbox_fd_write_revoke(const struct cheri_test *ctp);
 
 /* cheritest_libcheri.c */
+#define	CHERITEST_HELPER_PATH	"/usr/libexec/cheritest-helper"
+#define	CHERITEST_HELPER_MAXLEN	(4*1024*1024)
+
 extern struct sandbox_class	*cheritest_classp;
 extern struct sandbox_object	*cheritest_objectp;
+extern u_int			 cheritest_pool_constructed;
+extern u_int			 cheritest_pool_reused;
 
 void	test_sandbox_abort(const struct cheri_test *ctp);
 void	test_sandbox_cs_calloc(const struct cheri_test *ctp);
@@ -334,9 +468,24 @@ void	test_sandbox_varargs(const struct cheri_test *ctp);
 void	test_sandbox_va_copy(const struct cheri_test *ctp);
 void	test_sandbox_spin(const struct cheri_test *ctp);
 void	test_sandbox_userfn(const struct cheri_test *ctp);
+void	bench_sandbox_invoke(const struct cheri_test *ctp,
+	    uint64_t iterations);
+void	bench_sandbox_userfn(const struct cheri_test *ctp,
+	    uint64_t iterations);
+void	bench_sandbox_userfn_marshal(const struct cheri_test *ctp);
 void	test_2sandbox_newdestroy(const struct cheri_test *ctp);
-int	cheritest_libcheri_setup(void);
-void	cheritest_libcheri_destroy(void);
+int	cheritest_sandbox_class_setup(void);
+void	cheritest_sandbox_class_destroy(void);
+int	cheritest_sandbox_object_setup(void);
+int	cheritest_sandbox_object_reset(void);
+void	cheritest_sandbox_object_destroy(void);
+struct sandbox_object	*cheritest_sandbox_pool_get(void);
+void	cheritest_sandbox_pool_put(struct sandbox_object *sbop);
+struct cheritest_snapshot;
+int	cheritest_snapshot_new(struct sandbox_object *sbop,
+	    struct cheritest_snapshot **cspp);
+ssize_t	cheritest_snapshot_restore(struct cheritest_snapshot *csp);
+void	cheritest_snapshot_destroy(struct cheritest_snapshot *csp);
 
 /* cheritest_libcheri_local.c */
 void	test_sandbox_store_global_capability_in_bss(
@@ -356,12 +505,21 @@ void	test_sandbox_return_local_capability_nocatch(
 	    const struct cheri_test *ctp);
 void	test_sandbox_pass_local_capability_arg(const struct cheri_test *ctp);
 
+/*
+ * User-function methods of our own, beyond the CHERITEST_USERFN_* known to
+ * cheritest-helper, which passes them on unchanged.
+ */
+#define	CHERITEST_USERFN_ARGS	100	/* Takes every argument register. */
+#define	CHERITEST_USERFN_NEST	101	/* Calls back into the sandbox. */
+
 /* cheritest_libcheri_trustedstack.c */
 register_t	cheritest_libcheri_userfn_getstack(void);
 register_t	cheritest_libcheri_userfn_setstack(register_t arg);
+register_t	cheritest_libcheri_userfn_nest(register_t arg);
 void	test_sandbox_getstack(const struct cheri_test *ctp);
 void	test_sandbox_setstack(const struct cheri_test *ctp);
 void	test_sandbox_setstack_nop(const struct cheri_test *ctp);
+void	bench_sandbox_nest(const struct cheri_test *ctp, int maxdepth);
 
 /* cheritest_libcheri_var.c */
 void	test_sandbox_var_bss(const struct cheri_test *ctp);
@@ -378,6 +536,8 @@ void	test_string_memcpy(const struct cheri_test *ctp);
 void	test_string_memcpy_c(const struct cheri_test *ctp);
 void	test_string_memmove(const struct cheri_test *ctp);
 void	test_string_memmove_c(const struct cheri_test *ctp);
+void	bench_string_memcpy_c(const struct cheri_test *ctp,
+	    uint64_t iterations);
 
 /* cheritest_syscall.c */
 void	test_sandbox_syscall(const struct cheri_test *ctp);
@@ -372,3 +372,49 @@ test_fault_ccall_data_execute(const struct cheri_test *ctp __unused)
 	    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
 	cheritest_failure_errx("ccall returned successfull");
 }
+
+/*
+ * Round trips through each of the sandboxes above, timing the raw
+ * CCall/CReturn domain transition without libcheri's trusted stack
+ * management and register clearing.
+ */
+static void
+bench_ccall(__capability void *codecap, __capability void *datacap,
+    uint64_t iterations)
+{
+	struct cheri_object co;
+
+	co.co_codecap = codecap;
+	co.co_datacap = datacap;
+	while (iterations-- > 0)
+		(void)cheri_invoke(co, 0,
+		    0, 0, 0, 0, 0, 0, 0, 0,
+		    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+}
+
+void
+bench_ccall_creturn(const struct cheri_test *ctp __unused,
+    uint64_t iterations)
+{
+
+	bench_ccall(sandbox_creturn_codecap, sandbox_creturn_datacap,
+	    iterations);
+}
+
+void
+bench_ccall_nop_creturn(const struct cheri_test *ctp __unused,
+    uint64_t iterations)
+{
+
+	bench_ccall(sandbox_nop_creturn_codecap, sandbox_nop_creturn_datacap,
+	    iterations);
+}
+
+void
+bench_ccall_dli_creturn(const struct cheri_test *ctp __unused,
+    uint64_t iterations)
+{
+
+	bench_ccall(sandbox_dli_creturn_codecap, sandbox_dli_creturn_datacap,
+	    iterations);
+}
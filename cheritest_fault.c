@@ -399,3 +399,44 @@ test_sandbox_vm_xfault_nocatch(const struct cheri_test *ctp __unused)
 		    -1);
 	cheritest_success();
 }
+
+/*
+ * Fault-containment benchmarks: each iteration takes a fault in the sandbox,
+ * from which signal_handler() unwinds the trusted stack back to the
+ * invocation.  Where the helper method can take more than one kind of
+ * fault, ct_arg selects it.
+ */
+static void
+bench_sandbox_unwound(register_t v)
+{
+
+	if (v != CHERITEST_SANDBOX_UNWOUND)
+		cheritest_failure_errx(
+		    "Sandbox not unwound (returned 0x%jx instead of 0x%jx)",
+		    (uintmax_t)v, (uintmax_t)CHERITEST_SANDBOX_UNWOUND);
+}
+
+void
+bench_sandbox_cp2_fault(const struct cheri_test *ctp, uint64_t iterations)
+{
+
+	while (iterations-- > 0)
+		bench_sandbox_unwound(invoke_cap_fault(ctp->ct_arg));
+}
+
+void
+bench_sandbox_divzero(const struct cheri_test *ctp __unused,
+    uint64_t iterations)
+{
+
+	while (iterations-- > 0)
+		bench_sandbox_unwound(invoke_divzero());
+}
+
+void
+bench_sandbox_vm_fault(const struct cheri_test *ctp, uint64_t iterations)
+{
+
+	while (iterations-- > 0)
+		bench_sandbox_unwound(invoke_vm_fault(ctp->ct_arg));
+}
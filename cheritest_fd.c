@@ -65,6 +65,37 @@
 int zero_fd = -1;
 struct cheri_object stdin_fd_object, stdout_fd_object, zero_fd_object;
 
+/*
+ * Fixture for the fd tests (CT_FIXTURE_FD): CHERI objects representing
+ * stdin, stdout, and /dev/zero.
+ */
+int
+cheritest_fd_setup(void)
+{
+
+	if (cheri_fd_new(STDIN_FILENO, &stdin_fd_object) < 0)
+		err(EX_OSFILE, "cheri_fd_new: stdin");
+	if (cheri_fd_new(STDOUT_FILENO, &stdout_fd_object) < 0)
+		err(EX_OSFILE, "cheri_fd_new: stdout");
+	zero_fd = open("/dev/zero", O_RDWR);
+	if (zero_fd < 0)
+		err(EX_OSFILE, "open: /dev/zero");
+	if (cheri_fd_new(zero_fd, &zero_fd_object) < 0)
+		err(EX_OSFILE, "cheri_fd_new: /dev/zero");
+	return (0);
+}
+
+void
+cheritest_fd_destroy(void)
+{
+
+	cheri_fd_destroy(stdin_fd_object);
+	cheri_fd_destroy(stdout_fd_object);
+	cheri_fd_destroy(zero_fd_object);
+	close(zero_fd);
+	zero_fd = -1;
+}
+
 static char read_string[128];
 
 void
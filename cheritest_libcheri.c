@@ -35,11 +35,13 @@
 #error "This code requires a CHERI-aware compiler"
 #endif
 
-#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/mman.h>
 #include <sys/signal.h>
 #include <sys/syscall.h>
 #include <sys/sysctl.h>
 #include <sys/time.h>
+#include <sys/user.h>
 
 #include <machine/cpuregs.h>
 #include <machine/sysarch.h>
@@ -49,6 +51,7 @@
 #include <cheri/cheri_enter.h>
 #include <cheri/cheri_system.h>
 #include <cheri/cheri_fd.h>
+#include <cheri/cheri_invoke.h>
 #include <cheri/sandbox.h>
 
 #include <cheritest-helper.h>
@@ -56,6 +59,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <libutil.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -69,6 +73,50 @@ struct sandbox_object	*cheritest_objectp;
 
 struct cheri_object cheritest, cheritest2;
 
+/*
+ * A snapshot of a sandbox object's data (including BSS and heap) and stack,
+ * held in an anonymous shared-memory object, which preserves tags.  Each is
+ * divided into extents, one per VM map entry, so that guard pages can be
+ * skipped and each extent's protection kept.  Taking the snapshot copies
+ * every other page in full, and remaps it copy-on-write from the snapshot;
+ * restoring it remaps only the pages since written, as reported by
+ * mincore(2), so that its cost is proportional to the pages dirtied rather
+ * than to the size of the object.
+ */
+struct cheritest_snapshot_extent {
+	char	*cse_base;
+	size_t	 cse_len;
+	off_t	 cse_off;		/* Offset in the snapshot. */
+	int	 cse_prot;
+};
+
+struct cheritest_snapshot {
+	int		 cs_fd;
+	size_t		 cs_len;
+	char		*cs_vec;	/* mincore(2) vector. */
+	u_int		 cs_nextents;
+	struct cheritest_snapshot_extent	*cs_extents;
+};
+
+/*
+ * Pool of pre-instantiated objects of cheritest_classp.  Objects are reset
+ * when returned to the pool, restoring their data, BSS, and heap, so that
+ * each user is handed a clean object without paying for its construction.
+ * Each process has its own pool: batch workers inherit a copy of the
+ * supervisor's when forked, and tests forked for a single run never need
+ * to return theirs.
+ */
+#define	CHERITEST_POOL_SIZE	2	/* Default object + 1. */
+
+static struct cheritest_pool_entry {
+	struct sandbox_object		*cpe_sbop;
+	struct cheritest_snapshot	*cpe_snapshot;	/* NULL: none taken. */
+	int				 cpe_free;
+} cheritest_pool[CHERITEST_POOL_SIZE];
+static u_int			 cheritest_pool_len;
+u_int				 cheritest_pool_constructed;
+u_int				 cheritest_pool_reused;
+
 void
 test_sandbox_abort(const struct cheri_test *ctp __unused)
 {
@@ -315,6 +363,12 @@ cheritest_libcheri_userfn_handler(struct cheri_object system_object __unused,
 	case CHERITEST_USERFN_SETSTACK:
 		return (cheritest_libcheri_userfn_setstack(arg));
 
+	case CHERITEST_USERFN_ARGS:
+		return (0);
+
+	case CHERITEST_USERFN_NEST:
+		return (cheritest_libcheri_userfn_nest(arg));
+
 	default:
 		cheritest_failure_errx("%s: unexpected method %ld", __func__,
 		    methodnum);
@@ -335,10 +389,104 @@ test_sandbox_userfn(const struct cheri_test *ctp __unused)
 	cheritest_success();
 }
 
+/*
+ * Round trips into the default object, each calling a trivial method.
+ */
+void
+bench_sandbox_invoke(const struct cheri_test *ctp __unused,
+    uint64_t iterations)
+{
+
+	while (iterations-- > 0)
+		(void)invoke_get_var_data();
+}
+
+/*
+ * Round trips into the default object that each also call back to the
+ * host, via cheritest_libcheri_userfn_handler(); the cost of the callback
+ * is the difference from bench_sandbox_invoke.
+ */
+void
+bench_sandbox_userfn(const struct cheri_test *ctp __unused,
+    uint64_t iterations)
+{
+	register_t v;
+
+	for (; iterations > 0; iterations--) {
+		v = invoke_libcheri_userfn(CHERITEST_USERFN_RETURNARG,
+		    iterations);
+		if (v != (register_t)iterations)
+			cheritest_failure_errx("Incorrect return value "
+			    "0x%lx (expected 0x%lx)", v,
+			    (register_t)iterations);
+	}
+}
+
+/*
+ * Cost of passing arguments into cheritest_libcheri_userfn_handler(),
+ * across 0-8 integer and 0-5 capability arguments, the latter either NULL
+ * or tagged, reported as a sample of the picoseconds per call for each.
+ * The helper's methods take fixed arguments, and its libcheri_userfn only
+ * passes one on, so the calls are made from the host through the system
+ * object, which takes the same path into the handler as a sandbox's.
+ */
+#define	CHERITEST_MARSHAL_INTS	8
+#define	CHERITEST_MARSHAL_CAPS	5
+
+struct cheritest_marshal {
+	struct cheri_object	 cm_object;
+	register_t		 cm_a[CHERITEST_MARSHAL_INTS];
+	__capability void	*cm_c[CHERITEST_MARSHAL_CAPS];
+};
+
+static void
+cheritest_marshal_invoke(void *arg, uint64_t iterations)
+{
+	struct cheritest_marshal *cmp;
+
+	cmp = arg;
+	while (iterations-- > 0)
+		(void)cheri_invoke(cmp->cm_object,
+		    CHERI_SYSTEM_USER_BASE + CHERITEST_USERFN_ARGS,
+		    cmp->cm_a[0], cmp->cm_a[1], cmp->cm_a[2], cmp->cm_a[3],
+		    cmp->cm_a[4], cmp->cm_a[5], cmp->cm_a[6], cmp->cm_a[7],
+		    cmp->cm_c[0], cmp->cm_c[1], cmp->cm_c[2], cmp->cm_c[3],
+		    cmp->cm_c[4], NULL, NULL, NULL);
+}
+
+void
+bench_sandbox_userfn_marshal(const struct cheri_test *ctp __unused)
+{
+	struct cheritest_marshal cm;
+	char label[CHERITEST_EVENT_STR_LEN];
+	__capability void *cap;
+	u_int c, i, j, tagged;
+
+	cm.cm_object = sandbox_object_getsystemobject(cheritest_objectp);
+	for (tagged = 0; tagged < 2; tagged++) {
+		cap = tagged ? cheri_ptr(&cm, sizeof(cm)) : NULL;
+		for (c = tagged; c <= CHERITEST_MARSHAL_CAPS; c++) {
+			for (j = 0; j < CHERITEST_MARSHAL_CAPS; j++)
+				cm.cm_c[j] = j < c ? cap : NULL;
+			for (i = 0; i <= CHERITEST_MARSHAL_INTS; i++) {
+				for (j = 0; j < CHERITEST_MARSHAL_INTS; j++)
+					cm.cm_a[j] = j < i ? j + 1 : 0;
+				snprintf(label, sizeof(label),
+				    "%u ints, %u %scaps: ps/call", i, c,
+				    c == 0 ? "" : tagged ? "tagged " :
+				    "NULL ");
+				cheritest_sample(label, cheritest_bench_psec(
+				    cheritest_marshal_invoke, &cm));
+			}
+		}
+	}
+	cheritest_success();
+}
+
 /*
  * Most tests run within a single object instantiated by
- * cheritest_libcheri_setup().  These tests perform variations on the them of
- * "create a second object and optionally do stuff with it".
+ * cheritest_sandbox_object_setup().  These tests perform variations on the
+ * them of "create a second object and optionally do stuff with it".
  */
 void
 test_2sandbox_newdestroy(const struct cheri_test *ctp __unused)
@@ -388,28 +536,299 @@ test_sandbox_va_copy(const struct cheri_test *ctp __unused)
 		cheritest_success();
 }
 
+/*
+ * Fixture for tests that create their own objects of the cheritest-helper
+ * class (CT_FIXTURE_SANDBOX_CLASS).
+ */
 int
-cheritest_libcheri_setup(void)
+cheritest_sandbox_class_setup(void)
 {
 
-	/*
-	 * Prepare CHERI objects representing stdin, stdout, and /dev/zero.
-	 */
-	if (cheri_fd_new(STDIN_FILENO, &stdin_fd_object) < 0)
-		err(EX_OSFILE, "cheri_fd_new: stdin");
-	if (cheri_fd_new(STDOUT_FILENO, &stdout_fd_object) < 0)
-		err(EX_OSFILE, "cheri_fd_new: stdout");
-	zero_fd = open("/dev/zero", O_RDWR);
-	if (zero_fd < 0)
-		err(EX_OSFILE, "open: /dev/zero");
-	if (cheri_fd_new(zero_fd, &zero_fd_object) < 0)
-		err(EX_OSFILE, "cheri_fd_new: /dev/zero");
-
-	if (sandbox_class_new("/usr/libexec/cheritest-helper",
-	    4*1024*1024, &cheritest_classp) < 0)
+	if (sandbox_class_new(CHERITEST_HELPER_PATH, CHERITEST_HELPER_MAXLEN,
+	    &cheritest_classp) < 0)
 		return (-1);
-	if (sandbox_object_new(cheritest_classp, 2*1024*1024, &cheritest_objectp) < 0)
+	return (0);
+}
+
+void
+cheritest_sandbox_class_destroy(void)
+{
+
+	sandbox_class_destroy(cheritest_classp);
+	cheritest_classp = NULL;
+}
+
+/*
+ * Add the parts of the mappings in 'kvp' within the bounds of 'cap' to the
+ * snapshot, other than guard pages.  The bounds must be page-aligned, so
+ * that no page outside them is remapped.
+ */
+static int
+cheritest_snapshot_add(struct cheritest_snapshot *csp,
+    __capability void *cap, const struct kinfo_vmentry *kvp, int nkv)
+{
+	struct cheritest_snapshot_extent *csep;
+	size_t base, end, pagesize, start, top;
+	int i;
+
+	pagesize = getpagesize();
+	base = cheri_getbase(cap);
+	top = base + cheri_getlen(cap);
+	if ((base & (pagesize - 1)) != 0 || (top & (pagesize - 1)) != 0) {
+		errno = EINVAL;
 		return (-1);
+	}
+	for (i = 0; i < nkv; i++) {
+		start = MAX(base, kvp[i].kve_start);
+		end = MIN(top, kvp[i].kve_end);
+		if (start >= end)
+			continue;
+		if ((kvp[i].kve_protection & KVME_PROT_READ) == 0)
+			continue;		/* Guard page. */
+		csep = reallocarray(csp->cs_extents, csp->cs_nextents + 1,
+		    sizeof(*csp->cs_extents));
+		if (csep == NULL)
+			return (-1);
+		csp->cs_extents = csep;
+		csep = &csp->cs_extents[csp->cs_nextents++];
+		csep->cse_base = (char *)start;
+		csep->cse_len = end - start;
+		csep->cse_off = csp->cs_len;
+		csep->cse_prot = PROT_READ;
+		if (kvp[i].kve_protection & KVME_PROT_WRITE)
+			csep->cse_prot |= PROT_WRITE;
+		if (kvp[i].kve_protection & KVME_PROT_EXEC)
+			csep->cse_prot |= PROT_EXEC;
+		csp->cs_len += csep->cse_len;
+	}
+	return (0);
+}
+
+/*
+ * Remap, copy-on-write from the snapshot, the pages of an extent that have
+ * been written since they were last mapped from it, or all of them if 'all'
+ * is set.  Returns the number of pages remapped.
+ */
+static ssize_t
+cheritest_snapshot_remap(struct cheritest_snapshot *csp,
+    struct cheritest_snapshot_extent *csep, int all)
+{
+	size_t npages, p, q, pagesize;
+	ssize_t remapped;
+
+	pagesize = getpagesize();
+	npages = csep->cse_len / pagesize;
+	if (!all && mincore(csep->cse_base, csep->cse_len, csp->cs_vec) < 0)
+		return (-1);
+	remapped = 0;
+	for (p = 0; p < npages; p = q) {
+		if (!all && (csp->cs_vec[p] & MINCORE_MODIFIED) == 0) {
+			q = p + 1;
+			continue;
+		}
+		for (q = p + 1; q < npages &&
+		    (all || (csp->cs_vec[q] & MINCORE_MODIFIED) != 0); q++)
+			continue;
+		if (mmap(csep->cse_base + p * pagesize, (q - p) * pagesize,
+		    csep->cse_prot, MAP_FIXED | MAP_PRIVATE, csp->cs_fd,
+		    csep->cse_off + p * pagesize) == MAP_FAILED)
+			return (-1);
+		remapped += q - p;
+	}
+	return (remapped);
+}
+
+/*
+ * Snapshot an object, normally right after its construction.  Every page
+ * but the guard pages is copied: whether a page is resident says nothing
+ * about its contents, which may have been paged out, or not yet read from
+ * the file backing the object's data.
+ */
+int
+cheritest_snapshot_new(struct sandbox_object *sbop,
+    struct cheritest_snapshot **cspp)
+{
+	struct cheritest_snapshot *csp;
+	struct cheritest_snapshot_extent *csep;
+	struct kinfo_vmentry *kvp;
+	void * __capability *src, * __capability *dst;
+	char *snap;
+	size_t maxlen, w;
+	u_int i;
+	int nkv;
+
+	csp = calloc(1, sizeof(*csp));
+	if (csp == NULL)
+		return (-1);
+	csp->cs_fd = -1;
+	kvp = kinfo_getvmmap(getpid(), &nkv);
+	if (kvp == NULL)
+		goto error;
+	if (cheritest_snapshot_add(csp, sandbox_object_getsandboxdata(sbop),
+	    kvp, nkv) < 0 ||
+	    cheritest_snapshot_add(csp, sandbox_object_getsandboxstack(sbop),
+	    kvp, nkv) < 0) {
+		free(kvp);
+		goto error;
+	}
+	free(kvp);
+	maxlen = 0;
+	for (i = 0; i < csp->cs_nextents; i++)
+		maxlen = MAX(maxlen, csp->cs_extents[i].cse_len);
+	csp->cs_vec = malloc(maxlen / getpagesize() + 1);
+	if (csp->cs_vec == NULL)
+		goto error;
+	csp->cs_fd = shm_open(SHM_ANON, O_RDWR, 0600);
+	if (csp->cs_fd < 0)
+		goto error;
+	if (ftruncate(csp->cs_fd, csp->cs_len) < 0)
+		goto error;
+	snap = mmap(NULL, csp->cs_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+	    csp->cs_fd, 0);
+	if (snap == MAP_FAILED)
+		goto error;
+	for (i = 0; i < csp->cs_nextents; i++) {
+		/* Copy capability-sized words to preserve tags. */
+		csep = &csp->cs_extents[i];
+		src = (void * __capability *)csep->cse_base;
+		dst = (void * __capability *)(snap + csep->cse_off);
+		for (w = 0; w < csep->cse_len / sizeof(*src); w++)
+			dst[w] = src[w];
+	}
+	munmap(snap, csp->cs_len);
+	for (i = 0; i < csp->cs_nextents; i++) {
+		if (cheritest_snapshot_remap(csp, &csp->cs_extents[i], 1) < 0)
+			goto error;
+	}
+	*cspp = csp;
+	return (0);
+
+error:
+	cheritest_snapshot_destroy(csp);
+	return (-1);
+}
+
+/*
+ * Restore an object to its snapshot.  Returns the number of pages that had
+ * been written since the snapshot was taken or last restored.
+ */
+ssize_t
+cheritest_snapshot_restore(struct cheritest_snapshot *csp)
+{
+	ssize_t n, restored;
+	u_int i;
+
+	restored = 0;
+	for (i = 0; i < csp->cs_nextents; i++) {
+		n = cheritest_snapshot_remap(csp, &csp->cs_extents[i], 0);
+		if (n < 0)
+			return (-1);
+		restored += n;
+	}
+	return (restored);
+}
+
+/*
+ * Release a snapshot.  The object's pages remain mapped from it until the
+ * object is destroyed.
+ */
+void
+cheritest_snapshot_destroy(struct cheritest_snapshot *csp)
+{
+
+	if (csp->cs_fd != -1)
+		close(csp->cs_fd);
+	free(csp->cs_extents);
+	free(csp->cs_vec);
+	free(csp);
+}
+
+/*
+ * Construct an object, for the pool, with a snapshot of its initial state,
+ * which is taken if possible.
+ */
+static int
+cheritest_sandbox_pool_add(void)
+{
+	struct cheritest_pool_entry *cpep;
+
+	cpep = &cheritest_pool[cheritest_pool_len];
+	if (sandbox_object_new(cheritest_classp, 2*1024*1024,
+	    &cpep->cpe_sbop) < 0)
+		return (-1);
+	cheritest_pool_constructed++;
+	if (cheritest_snapshot_new(cpep->cpe_sbop, &cpep->cpe_snapshot) < 0)
+		cpep->cpe_snapshot = NULL;
+	cpep->cpe_free = 1;
+	cheritest_pool_len++;
+	return (0);
+}
+
+/*
+ * Take a clean object from the pool, constructing one if it is empty.
+ */
+struct sandbox_object *
+cheritest_sandbox_pool_get(void)
+{
+	struct sandbox_object *sbop;
+	u_int i;
+
+	for (i = 0; i < cheritest_pool_len; i++) {
+		if (cheritest_pool[i].cpe_free) {
+			cheritest_pool[i].cpe_free = 0;
+			cheritest_pool_reused++;
+			return (cheritest_pool[i].cpe_sbop);
+		}
+	}
+	if (sandbox_object_new(cheritest_classp, 2*1024*1024, &sbop) < 0)
+		return (NULL);
+	cheritest_pool_constructed++;
+	return (sbop);
+}
+
+/*
+ * Return an object to the pool, restoring its snapshot or, failing that,
+ * resetting it.  Objects constructed because the pool was empty, and those
+ * that can't be reset, are destroyed.
+ */
+void
+cheritest_sandbox_pool_put(struct sandbox_object *sbop)
+{
+	struct cheritest_pool_entry *cpep;
+	u_int i;
+
+	for (i = 0; i < cheritest_pool_len; i++) {
+		cpep = &cheritest_pool[i];
+		if (cpep->cpe_sbop != sbop)
+			continue;
+		if ((cpep->cpe_snapshot != NULL &&
+		    cheritest_snapshot_restore(cpep->cpe_snapshot) >= 0) ||
+		    sandbox_object_reset(sbop) >= 0) {
+			cpep->cpe_free = 1;
+			return;
+		}
+		if (cpep->cpe_snapshot != NULL)
+			cheritest_snapshot_destroy(cpep->cpe_snapshot);
+		*cpep = cheritest_pool[--cheritest_pool_len];
+		break;
+	}
+	sandbox_object_destroy(sbop);
+}
+
+/*
+ * Fixture for tests that invoke the default object (CT_FIXTURE_SANDBOX_OBJECT);
+ * requires the class fixture.  Fills the pool, from which the default object
+ * and any further objects used by the 2sandbox tests are taken.
+ */
+int
+cheritest_sandbox_object_setup(void)
+{
+
+	while (cheritest_pool_len < CHERITEST_POOL_SIZE) {
+		if (cheritest_sandbox_pool_add() < 0)
+			return (-1);
+	}
+	cheritest_objectp = cheritest_sandbox_pool_get();
 	cheritest = sandbox_object_getobject(cheritest_objectp);
 	cheritest2 = sandbox_object_getobject(cheritest_objectp);
 
@@ -418,12 +837,38 @@ cheritest_libcheri_setup(void)
 	return (0);
 }
 
-void
-cheritest_libcheri_destroy(void)
+/*
+ * Return the default object to the pool, and take a clean one, so that a
+ * test run in the same process as an earlier one does not see the state
+ * it left behind.
+ */
+int
+cheritest_sandbox_object_reset(void)
 {
 
-	sandbox_object_destroy(cheritest_objectp);
-	sandbox_class_destroy(cheritest_classp);
-	cheri_fd_destroy(zero_fd_object);
-	close(zero_fd);
+	cheritest_sandbox_pool_put(cheritest_objectp);
+	cheritest_objectp = cheritest_sandbox_pool_get();
+	if (cheritest_objectp == NULL)
+		return (-1);
+	cheritest = sandbox_object_getobject(cheritest_objectp);
+	cheritest2 = sandbox_object_getobject(cheritest_objectp);
+	return (0);
+}
+
+void
+cheritest_sandbox_object_destroy(void)
+{
+	struct cheritest_pool_entry *cpep;
+
+	while (cheritest_pool_len > 0) {
+		cpep = &cheritest_pool[--cheritest_pool_len];
+		if (cpep->cpe_sbop == cheritest_objectp)
+			cheritest_objectp = NULL;
+		sandbox_object_destroy(cpep->cpe_sbop);
+		if (cpep->cpe_snapshot != NULL)
+			cheritest_snapshot_destroy(cpep->cpe_snapshot);
+	}
+	if (cheritest_objectp != NULL)
+		sandbox_object_destroy(cheritest_objectp);
+	cheritest_objectp = NULL;
 }
@@ -45,6 +45,7 @@
 #include <cheri/cheric.h>
 #include <cheri/cheri_enter.h>
 #include <cheri/cheri_fd.h>
+#include <cheri/cheri_stack.h>
 #include <cheri/sandbox.h>
 
 #include <cheritest-helper.h>
@@ -52,6 +53,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -218,3 +220,169 @@ test_sandbox_setstack_nop(const struct cheri_test *ctp __unused)
 		cheritest_failure_errx("unexpected return value (%ld)", v);
 	cheritest_success();
 }
+
+/*
+ * Nested invocations: CHERITEST_USERFN_NEST calls back into the default
+ * object, which calls back into us, until 'arg' levels are open, each
+ * holding two trusted-stack frames.  The innermost level then performs
+ * cheritest_nest_action, whose result every level returns.
+ */
+#define	CHERITEST_NEST_RETURN	0	/* Return at once. */
+#define	CHERITEST_NEST_FRAMES	1	/* Return the frames in use. */
+#define	CHERITEST_NEST_GETSTACK	2	/* CHERITEST_NEST_CALLS GET_STACKs. */
+#define	CHERITEST_NEST_SETSTACK	3	/* CHERITEST_NEST_CALLS SET_STACKs. */
+#define	CHERITEST_NEST_UNWIND	4	/* Unwind every frame. */
+
+#define	CHERITEST_NEST_CALLS	64	/* sysarch() calls per round trip. */
+
+static u_int		cheritest_nest_action;
+
+register_t
+cheritest_libcheri_userfn_nest(register_t arg)
+{
+	struct cheri_stack cs;
+	u_int i;
+
+	if (arg > 1)
+		return (invoke_libcheri_userfn(CHERITEST_USERFN_NEST,
+		    arg - 1));
+	switch (cheritest_nest_action) {
+	case CHERITEST_NEST_RETURN:
+		break;
+
+	case CHERITEST_NEST_FRAMES:
+		if (sysarch(CHERI_GET_STACK, &cs) != 0)
+			cheritest_failure_err(
+			    "sysarch(CHERI_GET_STACK) failed");
+		return ((cs.cs_tsize - cs.cs_tsp) / CHERI_FRAME_SIZE);
+
+	case CHERITEST_NEST_GETSTACK:
+		for (i = 0; i < CHERITEST_NEST_CALLS; i++) {
+			if (sysarch(CHERI_GET_STACK, &cs) != 0)
+				cheritest_failure_err(
+				    "sysarch(CHERI_GET_STACK) failed");
+		}
+		break;
+
+	case CHERITEST_NEST_SETSTACK:
+		if (sysarch(CHERI_GET_STACK, &cs) != 0)
+			cheritest_failure_err(
+			    "sysarch(CHERI_GET_STACK) failed");
+		for (i = 0; i < CHERITEST_NEST_CALLS; i++) {
+			if (sysarch(CHERI_SET_STACK, &cs) != 0)
+				cheritest_failure_err(
+				    "sysarch(CHERI_SET_STACK) failed");
+		}
+		break;
+
+	case CHERITEST_NEST_UNWIND:
+		raise(SIGUSR1);
+		cheritest_failure_errx("trusted stack not unwound");
+	}
+	return (0);
+}
+
+static void
+cheritest_nest_signal_handler(int signum __unused,
+    siginfo_t *info __unused, void *vuap)
+{
+
+	if (cheri_stack_unwind(vuap, CHERITEST_SANDBOX_UNWOUND,
+	    CHERI_STACK_UNWIND_OP_ALL, 0) < 0)
+		_exit(EX_SOFTWARE);
+}
+
+static void
+cheritest_nest_run(void *arg, uint64_t iterations)
+{
+	register_t depth;
+
+	depth = (register_t)(uintptr_t)arg;
+	while (iterations-- > 0) {
+		if (invoke_libcheri_userfn(CHERITEST_USERFN_NEST, depth) !=
+		    (cheritest_nest_action == CHERITEST_NEST_UNWIND ?
+		    (register_t)CHERITEST_SANDBOX_UNWOUND : 0))
+			cheritest_failure_errx("unexpected return value at "
+			    "depth %ld", depth);
+	}
+}
+
+/*
+ * Time cheritest_nest_action at 'depth', in picoseconds, less 'nest', the
+ * round trip that reaches the innermost level, and divided among 'calls'
+ * operations made on each trip.
+ */
+static uint64_t
+cheritest_nest_time(register_t depth, uint64_t nest, u_int calls)
+{
+	uint64_t psec;
+
+	psec = cheritest_bench_psec(cheritest_nest_run,
+	    (void *)(uintptr_t)depth);
+	return (psec > nest ? (psec - nest) / calls : 0);
+}
+
+/*
+ * For each depth of nesting up to 'maxdepth', or as far as the trusted
+ * stack allows, report as samples the trusted-stack frames in use at the
+ * innermost level; the picoseconds that the level adds to a nested round
+ * trip over the one before, giving the curve of cost against depth; and,
+ * net of the round trip, the picoseconds per CHERI_GET_STACK and
+ * CHERI_SET_STACK, whose cost grows with the frames copied, and per unwind
+ * of every level from a signal raised at the innermost.
+ */
+void
+bench_sandbox_nest(const struct cheri_test *ctp __unused, int maxdepth)
+{
+	char label[CHERITEST_EVENT_STR_LEN];
+	struct sigaction oldsa, sa;
+	struct cheri_stack cs;
+	uint64_t nest, prev;
+	register_t depth;
+
+	if (sysarch(CHERI_GET_STACK, &cs) != 0)
+		cheritest_failure_err("sysarch(CHERI_GET_STACK) failed");
+	cheritest_sample("trusted-stack capacity (frames)", cs.cs_tsize /
+	    CHERI_FRAME_SIZE);
+	maxdepth = MIN(maxdepth, cs.cs_tsize / CHERI_FRAME_SIZE / 2);
+
+	sa.sa_sigaction = cheritest_nest_signal_handler;
+	sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGUSR1, &sa, &oldsa) < 0)
+		cheritest_failure_err("sigaction(SIGUSR1)");
+	prev = 0;
+	for (depth = 1; depth <= maxdepth; depth++) {
+		cheritest_nest_action = CHERITEST_NEST_FRAMES;
+		snprintf(label, sizeof(label), "depth %ld: frames in use",
+		    depth);
+		cheritest_sample(label, invoke_libcheri_userfn(
+		    CHERITEST_USERFN_NEST, depth));
+
+		cheritest_nest_action = CHERITEST_NEST_RETURN;
+		nest = cheritest_nest_time(depth, 0, 1);
+		snprintf(label, sizeof(label), "depth %ld: ps added by level",
+		    depth);
+		cheritest_sample(label, nest > prev ? nest - prev : 0);
+		prev = nest;
+
+		cheritest_nest_action = CHERITEST_NEST_GETSTACK;
+		snprintf(label, sizeof(label), "depth %ld: ps/GET_STACK",
+		    depth);
+		cheritest_sample(label, cheritest_nest_time(depth, nest,
+		    CHERITEST_NEST_CALLS));
+
+		cheritest_nest_action = CHERITEST_NEST_SETSTACK;
+		snprintf(label, sizeof(label), "depth %ld: ps/SET_STACK",
+		    depth);
+		cheritest_sample(label, cheritest_nest_time(depth, nest,
+		    CHERITEST_NEST_CALLS));
+
+		cheritest_nest_action = CHERITEST_NEST_UNWIND;
+		snprintf(label, sizeof(label), "depth %ld: ps/unwind", depth);
+		cheritest_sample(label, cheritest_nest_time(depth, nest, 1));
+	}
+	if (sigaction(SIGUSR1, &oldsa, NULL) < 0)
+		cheritest_failure_err("sigaction(SIGUSR1)");
+	cheritest_success();
+}
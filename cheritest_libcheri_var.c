@@ -117,7 +117,8 @@ test_2sandbox_var_data_getset(const struct cheri_test *ctp __unused)
 	struct sandbox_object *sbop;
 	register_t v;
 
-	if (sandbox_object_new(cheritest_classp, 2*1024*1024, &sbop) < 0)
+	sbop = cheritest_sandbox_pool_get();
+	if (sbop == NULL)
 		cheritest_failure_errx("sandbox_object_new() failed");
 
 	/*
@@ -135,7 +136,7 @@ test_2sandbox_var_data_getset(const struct cheri_test *ctp __unused)
 	if (v != 2)
 		cheritest_failure_errx(
 		    "additional sandbox object: set 2, got back %u", 2);
-	sandbox_object_destroy(sbop);
+	cheritest_sandbox_pool_put(sbop);
 	cheritest_success();
 }
 
@@ -40,6 +40,7 @@
 #include <cheri/cheri.h>
 #include <cheri/cheric.h>
 
+#include <stdint.h>
 #include <string.h>
 
 #include "cheritest.h"
@@ -420,3 +421,18 @@ test_string_memmove(const struct cheri_test *ctp __unused)
 
 	cheritest_success();
 }
+
+/*
+ * Explicit capability memcpy throughput, a page at a time.
+ */
+void
+bench_string_memcpy_c(const struct cheri_test *ctp __unused,
+    uint64_t iterations)
+{
+	static char dst[4096], src[4096];
+
+	while (iterations-- > 0) {
+		memcpy_c(CAP(dst), CAP(src), sizeof(dst));
+		__compiler_membar();
+	}
+}
@@ -41,20 +41,184 @@
 #include <sys/ucontext.h>
 #include <sys/wait.h>
 
+#include <machine/atomic.h>
+
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <setjmp.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sysexits.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "cheritest.h"
 
+/*
+ * When several tests are run back to back in one worker process, tests
+ * that complete return to cheritest_run_inprocess() rather than exiting.
+ */
+static sigjmp_buf	*cheritest_batch_env;
+static int		 cheritest_batch_status;
+
+static void __dead2
+cheritest_exit(int status)
+{
+
+	if (cheritest_batch_env != NULL) {
+		cheritest_batch_status = status;
+		siglongjmp(*cheritest_batch_env, 1);
+	}
+	exit(status);
+}
+
+/*
+ * Run a test in the current process, returning the exit status with which
+ * it would have terminated had it been run in a process of its own.
+ */
+int
+cheritest_run_inprocess(const struct cheri_test *ctp)
+{
+	sigjmp_buf env;
+
+	cheritest_batch_env = &env;
+	if (sigsetjmp(env, 1) == 0) {
+		if (ctp->ct_bench != NULL)
+			cheritest_bench(ctp);
+		else if (ctp->ct_arg != 0)
+			ctp->ct_func_arg(ctp, ctp->ct_arg);
+		else
+			ctp->ct_func(ctp);
+		cheritest_batch_status = 0;
+	}
+	cheritest_batch_env = NULL;
+	return (cheritest_batch_status);
+}
+
+/*
+ * The iterations in a benchmark batch are calibrated by doubling them until
+ * a batch takes at least an eighth of the target time, then scaling.  The
+ * warmup batches are discarded.  If cycles are being counted (--pmc), the
+ * cycles taken by each batch are recorded too.
+ */
+#define	CHERITEST_BENCH_TARGET_NSEC	10000000	/* Per batch: 10ms. */
+#define	CHERITEST_BENCH_MAX_ITERATIONS	(1ULL << 32)
+#define	CHERITEST_BENCH_WARMUP		2
+#define	CHERITEST_BENCH_BATCHES		20
+
+static uint64_t
+cheritest_bench_batch(void (*fn)(void *, uint64_t), void *arg,
+    uint64_t iterations, uint64_t *cyclesp)
+{
+	struct timespec end, start;
+	uint64_t cycles_end, cycles_start;
+	int counted;
+
+	counted = cheritest_pmc_cycles(&cycles_start) == 0;
+	if (clock_gettime(CLOCK_MONOTONIC, &start) < 0)
+		cheritest_failure_err("clock_gettime");
+	fn(arg, iterations);
+	if (clock_gettime(CLOCK_MONOTONIC, &end) < 0)
+		cheritest_failure_err("clock_gettime");
+	if (counted && cheritest_pmc_cycles(&cycles_end) == 0)
+		*cyclesp = cycles_end - cycles_start;
+	else
+		*cyclesp = 0;
+	return ((int64_t)(end.tv_sec - start.tv_sec) * 1000000000 +
+	    (end.tv_nsec - start.tv_nsec));
+}
+
+int
+cheritest_u64_compare(const void *a, const void *b)
+{
+	uint64_t x, y;
+
+	x = *(const uint64_t *)a;
+	y = *(const uint64_t *)b;
+	return (x < y ? -1 : x > y);
+}
+
+/*
+ * Time 'fn' in calibrated batches, returning the number of iterations in
+ * each and the batches' durations and cycles (0 if not counted), each
+ * sorted, in 'samples' and 'cycles'.
+ */
+static uint64_t
+cheritest_bench_measure(void (*fn)(void *, uint64_t), void *arg,
+    uint64_t samples[CHERITEST_BENCH_BATCHES],
+    uint64_t cycles[CHERITEST_BENCH_BATCHES])
+{
+	uint64_t iterations, nsec, unused;
+	u_int i;
+
+	iterations = 1;
+	for (;;) {
+		nsec = cheritest_bench_batch(fn, arg, iterations, &unused);
+		if (nsec >= CHERITEST_BENCH_TARGET_NSEC / 8 ||
+		    iterations >= CHERITEST_BENCH_MAX_ITERATIONS)
+			break;
+		iterations *= 2;
+	}
+	if (nsec < CHERITEST_BENCH_TARGET_NSEC)
+		iterations = MIN(iterations * CHERITEST_BENCH_TARGET_NSEC /
+		    MAX(nsec, 1), CHERITEST_BENCH_MAX_ITERATIONS);
+	for (i = 0; i < CHERITEST_BENCH_WARMUP; i++)
+		(void)cheritest_bench_batch(fn, arg, iterations, &unused);
+	for (i = 0; i < CHERITEST_BENCH_BATCHES; i++)
+		samples[i] = cheritest_bench_batch(fn, arg, iterations,
+		    &cycles[i]);
+	qsort(samples, CHERITEST_BENCH_BATCHES, sizeof(samples[0]),
+	    cheritest_u64_compare);
+	qsort(cycles, CHERITEST_BENCH_BATCHES, sizeof(cycles[0]),
+	    cheritest_u64_compare);
+	return (iterations);
+}
+
+uint64_t
+cheritest_bench_psec(void (*fn)(void *, uint64_t), void *arg)
+{
+	uint64_t cycles[CHERITEST_BENCH_BATCHES];
+	uint64_t iterations, samples[CHERITEST_BENCH_BATCHES];
+
+	iterations = cheritest_bench_measure(fn, arg, samples, cycles);
+	return (samples[CHERITEST_BENCH_BATCHES / 2] * 1000 / iterations);
+}
+
+static void
+cheritest_bench_test(void *arg, uint64_t iterations)
+{
+	const struct cheri_test *ctp;
+
+	ctp = arg;
+	ctp->ct_bench(ctp, iterations);
+}
+
+void
+cheritest_bench(const struct cheri_test *ctp)
+{
+	uint64_t cycles[CHERITEST_BENCH_BATCHES];
+	uint64_t iterations, samples[CHERITEST_BENCH_BATCHES];
+
+	iterations = cheritest_bench_measure(cheritest_bench_test,
+	    __DECONST(struct cheri_test *, ctp), samples, cycles);
+	ccsp->ccs_bench_iterations = iterations;
+	ccsp->ccs_bench_nsec_min = samples[0];
+	ccsp->ccs_bench_nsec_median = samples[CHERITEST_BENCH_BATCHES / 2];
+	ccsp->ccs_bench_nsec_p90 = samples[CHERITEST_BENCH_BATCHES * 9 / 10];
+	ccsp->ccs_bench_nsec_max = samples[CHERITEST_BENCH_BATCHES - 1];
+	ccsp->ccs_bench_batches = CHERITEST_BENCH_BATCHES;
+	ccsp->ccs_bench_cycles_min = cycles[0];
+	ccsp->ccs_bench_cycles_median = cycles[CHERITEST_BENCH_BATCHES / 2];
+	ccsp->ccs_bench_cycles_p90 = cycles[CHERITEST_BENCH_BATCHES * 9 / 10];
+	ccsp->ccs_bench_cycles_max = cycles[CHERITEST_BENCH_BATCHES - 1];
+	cheritest_success();
+}
+
 static void
 vcheritest_failure_errx(const char *msg, va_list ap)
 {
@@ -89,7 +253,7 @@ cheritest_failure_errx(const char *msg, ...)
 	va_start(ap, msg);
 	vcheritest_failure_errx(msg, ap);
 	va_end(ap);
-	exit(EX_SOFTWARE);
+	cheritest_exit(EX_SOFTWARE);
 }
 
 void
@@ -99,7 +263,7 @@ cheritest_failure_err(const char *msg, ...)
 	va_start(ap, msg);
 	vcheritest_failure_err(msg, ap);
 	va_end(ap);
-	exit(EX_SOFTWARE);
+	cheritest_exit(EX_SOFTWARE);
 }
 
 void
@@ -107,5 +271,50 @@ cheritest_success(void)
 {
 
 	ccsp->ccs_testresult = TESTRESULT_SUCCESS;
-	exit(0);
+	cheritest_exit(0);
+}
+
+/*
+ * Append an event to the ring in this test's slot.  The entry is first
+ * invalidated, so that a parent reading it concurrently sees that it has
+ * been overwritten, and only then filled in and published.
+ */
+static void
+cheritest_event(u_int type, const char *str, uint64_t value)
+{
+	struct cheritest_slot *csp;
+	struct cheritest_event *cep;
+	u_int seq;
+
+	csp = (struct cheritest_slot *)ccsp;
+	seq = csp->cs_seq;
+	cep = &csp->cs_events[seq % CHERITEST_EVENTS];
+	atomic_store_rel_int(&cep->ce_seq, 0);
+	atomic_thread_fence_rel();
+	cep->ce_type = type;
+	cep->ce_value = value;
+	strlcpy(cep->ce_str, str, sizeof(cep->ce_str));
+	atomic_store_rel_int(&cep->ce_seq, seq + 1);
+	atomic_store_rel_int(&csp->cs_seq, seq + 1);
+}
+
+void
+cheritest_checkpoint(const char *label)
+{
+
+	cheritest_event(CHERITEST_EVENT_CHECKPOINT, label, 0);
+}
+
+void
+cheritest_subcase(const char *name, int result)
+{
+
+	cheritest_event(CHERITEST_EVENT_SUBCASE, name, result);
+}
+
+void
+cheritest_sample(const char *label, uint64_t value)
+{
+
+	cheritest_event(CHERITEST_EVENT_SAMPLE, label, value);
 }
@@ -15,7 +15,7 @@ BEGIN {
 		exit 1
 	}
 	sub(/[,}]*$/, "", $value)
-	if ($member ~ /\.ct_func/)
+	if ($member ~ /\.ct_func/ || $member ~ /\.ct_bench/)
 		funcs[$value]
 	else if ($member ~ /\.ct_check_xfail/)
 		xfail_funcs[$value]
@@ -0,0 +1,281 @@
+#!/usr/bin/awk -f
+#
+# Generate cheritest_registry.h from cheritest.c and, optionally, the
+# cheri-c-tests cheri_c_testdecls.h:
+#
+# - an enumeration of the entries of cheri_tests[], so that a test's
+#   CHERITEST_ID_<name> is its index in the table;
+# - a perfect hash over the test names, using hash and displace: a name's
+#   bucket selects the multiplier used to hash it to its slot;
+# - CHERITEST_TAG_* tags for each test, from which cheritest builds the
+#   per-tag sets of tests used for selection and listing.
+#
+# Preprocessor conditionals within cheri_tests[] are reproduced around each
+# generated entry, so that the output is correct in any configuration.  The
+# cheri-c-tests are hashed like any other test, so if cheri_tests[] includes
+# them but cheri_c_testdecls.h is not given, the output refuses to compile
+# with CHERI_C_TESTS defined.
+#
+
+BEGIN {
+	# Prime below 2^24, so that hash arithmetic is exact in awk.
+	PRIME = 16777213
+	MULT = 31
+	for (i = 32; i < 127; i++)
+		ord[sprintf("%c", i)] = i
+	ntests = 0
+	nenum = 0
+	depth = 0
+	intable = 0
+	inmacro = 0
+	cdecls = 0
+	cinclude = 0
+}
+
+function hash(s, mult,    h, i) {
+	h = 0
+	for (i = 1; i <= length(s); i++)
+		h = (h * mult + ord[substr(s, i, 1)]) % PRIME
+	return (h)
+}
+
+# The conditionals enclosing the current line, as preprocessor lines.
+function context(    c, i) {
+	c = ""
+	for (i = 1; i <= depth; i++)
+		c = c cond[i]
+	return (c)
+}
+
+function endifs(n,    c, i) {
+	c = ""
+	for (i = 0; i < n; i++)
+		c = c "#endif\n"
+	return (c)
+}
+
+function add(name, ctx, ctxdepth, tags) {
+	if (name in ids) {
+		printf("duplicate test name: %s\n", name) > "/dev/stderr"
+		exit 1
+	}
+	ids[name] = ntests
+	names[ntests] = name
+	ctxs[ntests] = ctx
+	ctxdepths[ntests] = ctxdepth
+	tagexprs[ntests] = tags
+	ntests++
+}
+
+function addtag(tag) {
+	if (cur < 0 || index(tagexprs[cur], tag) != 0)
+		return
+	if (tagexprs[cur] == "")
+		tagexprs[cur] = tag
+	else
+		tagexprs[cur] = tagexprs[cur] " | " tag
+}
+
+FILENAME ~ /cheri_c_testdecls\.h$/ {
+	cdecls = 1
+	if ($0 ~ /^DECLARE_TEST\(/) {
+		name = $0
+		sub(/^DECLARE_TEST\([ \t]*/, "", name)
+		sub(/[ \t]*,.*/, "", name)
+		add("cheri_c_test_" name, "#ifdef CHERI_C_TESTS\n", 1, "")
+	}
+	next
+}
+
+/^static const struct cheri_test cheri_tests\[\] = \{/ {
+	intable = 1
+	cur = -1
+	next
+}
+
+!intable {
+	next
+}
+
+/^\};/ {
+	intable = 0
+	next
+}
+
+inmacro {
+	if ($0 !~ /\\$/)
+		inmacro = 0
+	next
+}
+
+/^#[ \t]*define/ {
+	if ($0 ~ /\\$/)
+		inmacro = 1
+	next
+}
+
+/^#[ \t]*undef/ {
+	next
+}
+
+/^#[ \t]*include[ \t]*<cheri_c_testdecls\.h>/ {
+	cinclude = 1
+	enum[nenum++] = "#define\tDECLARE_TEST(name, desc)\tCHERITEST_ID_cheri_c_test_ ## name,"
+	enum[nenum++] = "#define\tDECLARE_TEST_FAULT(name, desc)"
+	enum[nenum++] = "#include <cheri_c_testdecls.h>"
+	enum[nenum++] = "#undef\tDECLARE_TEST"
+	enum[nenum++] = "#undef\tDECLARE_TEST_FAULT"
+	next
+}
+
+/^#[ \t]*if/ {
+	depth++
+	cond[depth] = $0 "\n"
+	purecap[depth] = ($0 ~ /__CHERI_PURE_CAPABILITY__/ && $0 !~ /!/)
+	enum[nenum++] = $0
+	next
+}
+
+/^#[ \t]*el/ {
+	cond[depth] = cond[depth] $0 "\n"
+	purecap[depth] = 0
+	enum[nenum++] = $0
+	next
+}
+
+/^#[ \t]*endif/ {
+	depth--
+	enum[nenum++] = $0
+	next
+}
+
+/\.ct_name = "/ {
+	name = $0
+	sub(/.*\.ct_name = "/, "", name)
+	sub(/".*/, "", name)
+	tags = ""
+	for (i = 1; i <= depth; i++) {
+		if (purecap[i])
+			tags = "CHERITEST_TAG_PURECAP"
+	}
+	add(name, context(), depth, tags)
+	cur = ntests - 1
+	enum[nenum++] = "\tCHERITEST_ID_" name ","
+}
+
+/CT_FLAG_SANDBOX/ {
+	addtag("CHERITEST_TAG_SANDBOX")
+}
+
+/CT_FLAG_SLOW/ {
+	addtag("CHERITEST_TAG_SLOW")
+}
+
+/CT_FLAG_SIGNAL/ {
+	addtag("CHERITEST_TAG_SIGNAL")
+}
+
+/CT_FLAG_BENCH/ {
+	addtag("CHERITEST_TAG_BENCH")
+}
+
+END {
+	if (ntests == 0) {
+		printf("no tests found\n") > "/dev/stderr"
+		exit 1
+	}
+
+	nbuckets = int(ntests / 4) + 1
+	nslots = 2 * ntests + 1
+	maxsize = 0
+	for (t = 0; t < ntests; t++) {
+		b = hash(names[t], MULT) % nbuckets
+		bucket[b, bsize[b]++] = t
+		if (bsize[b] > maxsize)
+			maxsize = bsize[b]
+	}
+
+	# Place the largest buckets first, while there is most freedom.
+	for (size = maxsize; size > 0; size--) {
+		for (b = 0; b < nbuckets; b++) {
+			if (bsize[b] != size)
+				continue
+			for (m = MULT + 2; ; m += 2) {
+				if (m > 1000000) {
+					printf("no perfect hash found\n") > \
+					    "/dev/stderr"
+					exit 1
+				}
+				ok = 1
+				for (i = 0; i < size; i++) {
+					s = hash(names[bucket[b, i]], m) % nslots
+					try[i] = s
+					if (s in slot)
+						ok = 0
+					for (j = 0; j < i; j++) {
+						if (try[j] == s)
+							ok = 0
+					}
+					if (!ok)
+						break
+				}
+				if (ok)
+					break
+			}
+			mults[b] = m
+			for (i = 0; i < size; i++)
+				slot[try[i]] = bucket[b, i]
+		}
+	}
+	for (b = 0; b < nbuckets; b++) {
+		if (!(b in mults))
+			mults[b] = MULT
+	}
+
+	printf("/*\n")
+	printf(" * Generated from cheritest.c by gen_cheritest_registry.awk;")
+	printf(" do not edit.\n */\n\n")
+
+	if (cinclude && !cdecls) {
+		printf("#ifdef CHERI_C_TESTS\n")
+		printf("#error \"cheri_c_testdecls.h was not given to ")
+		printf("gen_cheritest_registry.awk\"\n#endif\n\n")
+	}
+
+	printf("enum cheritest_test_id {\n")
+	for (i = 0; i < nenum; i++)
+		printf("%s\n", enum[i])
+	printf("\tCHERITEST_NTESTS\n};\n\n")
+
+	printf("#define\tCHERITEST_HASH_PRIME\t%d\n", PRIME)
+	printf("#define\tCHERITEST_HASH_MULT\t%d\n", MULT)
+	printf("#define\tCHERITEST_HASH_BUCKETS\t%d\n", nbuckets)
+	printf("#define\tCHERITEST_HASH_SLOTS\t%d\n\n", nslots)
+
+	printf("static const uint32_t ")
+	printf("cheritest_hash_mults[CHERITEST_HASH_BUCKETS] = {\n")
+	for (b = 0; b < nbuckets; b++)
+		printf("\t%d,\n", mults[b])
+	printf("};\n\n")
+
+	printf("/* CHERITEST_ID_<name> + 1 for each slot; 0: empty. */\n")
+	printf("static const uint16_t ")
+	printf("cheritest_hash_slots[CHERITEST_HASH_SLOTS] = {\n")
+	for (s = 0; s < nslots; s++) {
+		if (!(s in slot))
+			continue
+		t = slot[s]
+		printf("%s\t[%d] = CHERITEST_ID_%s + 1,\n%s", ctxs[t], s,
+		    names[t], endifs(ctxdepths[t]))
+	}
+	printf("};\n\n")
+
+	printf("static const uint8_t cheritest_tags[CHERITEST_NTESTS] = {\n")
+	for (t = 0; t < ntests; t++) {
+		if (tagexprs[t] == "")
+			continue
+		printf("%s\t[CHERITEST_ID_%s] = %s,\n%s", ctxs[t], names[t],
+		    tagexprs[t], endifs(ctxdepths[t]))
+	}
+	printf("};\n")
+}